@@ -1,10 +1,35 @@
+#include <algorithm>
 #include <cassert>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <list>
 #include <sstream>
 #include <map>
+#include <mutex>
+#include <random>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 #include <set>
+#include <stdexcept>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "unit-tests-lib.cpp"
 
 using namespace std;
 
@@ -13,18 +38,22 @@ enum class QueryType {
     BusesForStop,
     StopsForBus,
     AllBuses,
+    Journey,
 };
 
 const map<string, QueryType> string_to_query_type_ = {{"ALL_BUSES", QueryType::AllBuses},
                                                 {"NEW_BUS", QueryType::NewBus},
                                                 {"BUSES_FOR_STOP", QueryType::BusesForStop},
-                                                {"STOPS_FOR_BUS", QueryType::StopsForBus}}
+                                                {"STOPS_FOR_BUS", QueryType::StopsForBus},
+                                                {"JOURNEY", QueryType::Journey}}
                                                 ;
 
 struct Query {
     QueryType type;
     string bus;
     string stop;
+    // Where a journey from stop ends
+    string destination;
     vector<string> stops;
 };
 
@@ -34,14 +63,14 @@ ostream& operator<<(ostream& out, const vector<T>& container) {
     for (const T& el: container) {
         if (el != container.at(len - 1)) {
             if (el.find("\n") != -1) {
-                cout << el;
+                out << el;
             }
             else {
-                cout << el << " "s;
+                out << el << " "s;
             }
         }
         else {
-            cout << el;
+            out << el;
         }
     }
     return out;
@@ -71,10 +100,191 @@ istream& operator>>(istream& is, Query& q) {
     case QueryType::StopsForBus:
         is >> q.bus;
         break;
+
+    case QueryType::Journey:
+        is >> q.stop >> q.destination;
+        break;
     }
     return is;
 }
 
+// A query whose names point into the scanned input
+struct QueryView {
+    QueryType type;
+    string_view bus;
+    string_view stop;
+    string_view destination;
+    vector<string_view> stops;
+};
+
+// Splits the query protocol into whitespace-separated tokens without
+// copying them, and picks the command by its first byte
+class QueryScanner {
+public:
+    explicit QueryScanner(string_view input)
+        : input_(input)
+    {}
+
+    // Returns 0 at the end of the input, as istream input did
+    int ReadNumber() {
+        const string_view token = NextToken();
+        int number = 0;
+        if (token.empty()) {
+            return number;
+        }
+        if (from_chars(token.data(), token.data() + token.size(), number).ec != errc()) {
+            throw invalid_argument("Expected a number, got \""s + string(token) + "\""s);
+        }
+        return number;
+    }
+
+    // Reads the next query into q, reusing the memory of its stop list.
+    // Returns false at the end of the input
+    bool Read(QueryView& q) {
+        const string_view command = NextToken();
+        if (command.empty()) {
+            return false;
+        }
+        switch (command[0]) {
+            case 'N':
+                CheckCommand(command, "NEW_BUS"sv);
+                q.type = QueryType::NewBus;
+                q.bus = NextToken();
+                ReadStops(q.stops);
+                break;
+            case 'B':
+                CheckCommand(command, "BUSES_FOR_STOP"sv);
+                q.type = QueryType::BusesForStop;
+                q.stop = NextToken();
+                break;
+            case 'S':
+                CheckCommand(command, "STOPS_FOR_BUS"sv);
+                q.type = QueryType::StopsForBus;
+                q.bus = NextToken();
+                break;
+            case 'A':
+                CheckCommand(command, "ALL_BUSES"sv);
+                q.type = QueryType::AllBuses;
+                break;
+            case 'J':
+                CheckCommand(command, "JOURNEY"sv);
+                q.type = QueryType::Journey;
+                q.stop = NextToken();
+                q.destination = NextToken();
+                break;
+            default:
+                CheckCommand(command, ""sv);
+        }
+        return true;
+    }
+
+private:
+    string_view input_;
+    size_t position_ = 0;
+
+    // The count comes from the input, so it is not trusted: a negative
+    // one gives no stops, as istream input did, and a count past the end
+    // of the input gets the stops that are there
+    void ReadStops(vector<string_view>& stops) {
+        const int stop_count = ReadNumber();
+        stops.clear();
+        for (int i = 0; i < stop_count; ++i) {
+            const string_view stop = NextToken();
+            if (stop.empty()) {
+                break;
+            }
+            stops.push_back(stop);
+        }
+    }
+
+    static bool IsSpace(char c) {
+        return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+    }
+
+    string_view NextToken() {
+        while (position_ < input_.size() && IsSpace(input_[position_])) {
+            ++position_;
+        }
+        const size_t begin = position_;
+        while (position_ < input_.size() && !IsSpace(input_[position_])) {
+            ++position_;
+        }
+        return input_.substr(begin, position_ - begin);
+    }
+
+    static void CheckCommand(string_view command, string_view expected) {
+        if (command != expected) {
+            throw out_of_range("Unknown query \""s + string(command) + "\""s);
+        }
+    }
+};
+
+// The whole standard input or a file: mapped into memory when it is a
+// regular file, read into a buffer otherwise
+class InputBuffer {
+public:
+    InputBuffer() {
+        if (Map(STDIN_FILENO)) {
+            return;
+        }
+        char chunk[1 << 16];
+        size_t read_size;
+        while ((read_size = fread(chunk, 1, sizeof(chunk), stdin)) > 0) {
+            buffer_.append(chunk, read_size);
+        }
+    }
+
+    explicit InputBuffer(const string& path) {
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd == -1) {
+            throw runtime_error("cannot open "s + path);
+        }
+        if (!Map(fd)) {
+            char chunk[1 << 16];
+            ssize_t read_size;
+            while ((read_size = read(fd, chunk, sizeof(chunk))) > 0) {
+                buffer_.append(chunk, read_size);
+            }
+        }
+        close(fd);
+    }
+
+    InputBuffer(const InputBuffer&) = delete;
+    InputBuffer& operator=(const InputBuffer&) = delete;
+
+    ~InputBuffer() {
+        if (mapped_data_ != nullptr) {
+            munmap(const_cast<char*>(mapped_data_), mapped_size_);
+        }
+    }
+
+    string_view GetView() const {
+        if (mapped_data_ != nullptr) {
+            return {mapped_data_, mapped_size_};
+        }
+        return buffer_;
+    }
+
+private:
+    const char* mapped_data_ = nullptr;
+    size_t mapped_size_ = 0;
+    string buffer_;
+
+    bool Map(int fd) {
+        struct stat info;
+        if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size == 0) {
+            return false;
+        }
+        void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            return false;
+        }
+        mapped_data_ = static_cast<const char*>(data);
+        mapped_size_ = info.st_size;
+        return true;
+    }
+};
+
 struct BusesForStopResponse {
     vector<string> response_message;
 };
@@ -102,99 +312,1096 @@ ostream& operator<<(ostream& os, const AllBusesResponse& r) {
     return os;
 }
 
+struct JourneyResponse {
+    vector<string> response_message;
+};
+
+ostream& operator<<(ostream& os, const JourneyResponse& r) {
+    os << r.response_message;
+    return os;
+}
+
+// Interns names to dense ids given in order of first appearance
+class NameTable {
+public:
+    inline static constexpr int NO_NAME = -1;
+
+    int Intern(string_view name) {
+        const auto it = ids_.find(name);
+        if (it != ids_.end()) {
+            return it->second;
+        }
+        const int id = names_.size();
+        names_.emplace_back(name);
+        ids_.emplace(names_.back(), id);
+        return id;
+    }
+
+    int Find(string_view name) const {
+        const auto it = ids_.find(name);
+        return it != ids_.end() ? it->second : NO_NAME;
+    }
+
+    const string& GetName(int id) const {
+        return names_[id];
+    }
+
+    int GetSize() const {
+        return names_.size();
+    }
+
+    void Reserve(size_t count) {
+        ids_.reserve(count);
+    }
+
+private:
+    // A deque never moves its strings, so the views in ids_ stay valid
+    deque<string> names_;
+    unordered_map<string_view, int> ids_;
+};
+
+const size_t MIN_PENDING_EDGES_TO_COMPACT = 256;
+const size_t OUTPUT_BUFFER_SIZE = 1 << 16;
+
+// Appends response words to a buffer joined the way a response vector
+// is printed: a space follows every word that has no newline in it and
+// is not equal to the last word of the response.
+// A word is passed in two parts, e.g. a bus name and ":"
+class ResponseWriter {
+public:
+    ResponseWriter(string& out, string_view last_word, string_view last_suffix)
+        : out_(out)
+        , last_word_(last_word)
+        , last_suffix_(last_suffix)
+    {}
+
+    void Write(string_view word, string_view suffix = ""sv) {
+        out_ += word;
+        out_ += suffix;
+        if (word.find('\n') == string_view::npos && suffix.find('\n') == string_view::npos
+            && !IsLastWord(word, suffix)) {
+            out_ += ' ';
+        }
+    }
+
+private:
+    string& out_;
+    string_view last_word_;
+    string_view last_suffix_;
+
+    bool IsLastWord(string_view word, string_view suffix) const {
+        if (word.size() + suffix.size() != last_word_.size() + last_suffix_.size()) {
+            return false;
+        }
+        const auto at = [](string_view first, string_view second, size_t i) {
+            return i < first.size() ? first[i] : second[i - first.size()];
+        };
+        for (size_t i = 0; i < word.size() + suffix.size(); ++i) {
+            if (at(word, suffix, i) != at(last_word_, last_suffix_, i)) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+const size_t RESPONSE_CACHE_SIZE = 64 << 20;
+
+struct ResponseCacheStats {
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t invalidations = 0;
+    size_t evictions = 0;
+    size_t entries = 0;
+    size_t bytes = 0;
+};
+
+// Rendered STOPS_FOR_BUS and BUSES_FOR_STOP answers keyed by id. Once
+// their size passes the limit the least recently used ones are evicted.
+// Readers on several threads take no lock: each looks entries up through
+// the const methods and writes what it did to its own Log, and the logs
+// are applied once they are all done
+class ResponseCache {
+public:
+    enum class Kind {
+        StopsForBus,
+        BusesForStop,
+    };
+
+    // Hits, misses and new answers of one reader, kept until Apply
+    class Log {
+        friend class ResponseCache;
+
+        vector<uint64_t> hit_keys_;
+        vector<pair<uint64_t, string>> inserts_;
+        size_t misses_ = 0;
+    };
+
+    explicit ResponseCache(size_t max_bytes)
+        : max_bytes_(max_bytes)
+    {}
+
+    // Appends the cached text to out and marks it as recently used.
+    // Returns false if there is no such entry
+    bool AppendTo(Kind kind, int id, string& out) {
+        const auto it = Find(kind, id);
+        if (it == entries_.end()) {
+            stats_.misses += max_bytes_ != 0;
+            return false;
+        }
+        ++stats_.hits;
+        recently_used_.splice(recently_used_.begin(), recently_used_, it->second.position);
+        out += it->second.text;
+        return true;
+    }
+
+    // Same for a reader running alongside others; the hit is only logged
+    bool AppendTo(Kind kind, int id, string& out, Log& log) const {
+        const auto it = Find(kind, id);
+        if (it == entries_.end()) {
+            log.misses_ += max_bytes_ != 0;
+            return false;
+        }
+        log.hit_keys_.push_back(it->first);
+        out += it->second.text;
+        return true;
+    }
+
+    void Insert(Kind kind, int id, string_view text, Log& log) const {
+        if (max_bytes_ != 0) {
+            log.inserts_.emplace_back(MakeKey(kind, id), string(text));
+        }
+    }
+
+    // Replays a log in order and empties it, keeping its capacity
+    void Apply(Log& log) {
+        stats_.misses += log.misses_;
+        for (const uint64_t key: log.hit_keys_) {
+            const auto it = entries_.find(key);
+            if (it != entries_.end()) {
+                ++stats_.hits;
+                recently_used_.splice(recently_used_.begin(), recently_used_, it->second.position);
+            }
+        }
+        for (auto& [key, text]: log.inserts_) {
+            Insert(key, move(text));
+        }
+        log.hit_keys_.clear();
+        log.inserts_.clear();
+        log.misses_ = 0;
+    }
+
+    void Insert(Kind kind, int id, string_view text) {
+        Insert(MakeKey(kind, id), string(text));
+    }
+
+    void Invalidate(Kind kind, int id) {
+        if (Erase(MakeKey(kind, id))) {
+            ++stats_.invalidations;
+        }
+    }
+
+    void SetMaxBytes(size_t max_bytes) {
+        max_bytes_ = max_bytes;
+        while (stats_.bytes > max_bytes_) {
+            Erase(recently_used_.back());
+            ++stats_.evictions;
+        }
+    }
+
+    ResponseCacheStats GetStats() const {
+        return stats_;
+    }
+
+    void Clear() {
+        stats_.invalidations += entries_.size();
+        entries_.clear();
+        recently_used_.clear();
+        stats_.entries = 0;
+        stats_.bytes = 0;
+    }
+
+private:
+    struct Entry {
+        string text;
+        list<uint64_t>::iterator position;
+    };
+
+    // Hash node, list node and string header of one entry
+    inline static constexpr size_t ENTRY_OVERHEAD = 96;
+
+    unordered_map<uint64_t, Entry> entries_;
+    // Most recently used first
+    list<uint64_t> recently_used_;
+    size_t max_bytes_;
+    ResponseCacheStats stats_;
+
+    static uint64_t MakeKey(Kind kind, int id) {
+        return (static_cast<uint64_t>(kind) << 32) | static_cast<uint32_t>(id);
+    }
+
+    static size_t GetEntrySize(string_view text) {
+        return text.size() + ENTRY_OVERHEAD;
+    }
+
+    unordered_map<uint64_t, Entry>::const_iterator Find(Kind kind, int id) const {
+        if (max_bytes_ == 0) {
+            return entries_.end();
+        }
+        return entries_.find(MakeKey(kind, id));
+    }
+
+    void Insert(uint64_t key, string text) {
+        const size_t size = GetEntrySize(text);
+        if (size > max_bytes_) {
+            return;
+        }
+        Erase(key);
+        while (stats_.bytes + size > max_bytes_) {
+            Erase(recently_used_.back());
+            ++stats_.evictions;
+        }
+        recently_used_.push_front(key);
+        entries_.emplace(key, Entry{move(text), recently_used_.begin()});
+        stats_.bytes += size;
+        ++stats_.entries;
+    }
+
+    bool Erase(uint64_t key) {
+        const auto it = entries_.find(key);
+        if (it == entries_.end()) {
+            return false;
+        }
+        stats_.bytes -= GetEntrySize(it->second.text);
+        --stats_.entries;
+        recently_used_.erase(it->second.position);
+        entries_.erase(it);
+        return true;
+    }
+};
+
+// A snapshot is a header followed by arrays of uint32_t in the order of
+// its fields and then the bytes of the bus and stop names. Numbers are
+// stored in the byte order of the machine that wrote them
+const char SNAPSHOT_MAGIC[8] = {'B', 'U', 'S', 'S', 'N', 'A', 'P', '\0'};
+const uint32_t SNAPSHOT_VERSION = 1;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t bus_count;
+    uint32_t stop_count;
+    uint32_t route_stop_count;
+    uint32_t stop_bus_count;
+    uint32_t transfer_count;
+    uint32_t bus_name_bytes;
+    uint32_t stop_name_bytes;
+};
+
 class BusManager {
 public:
     void AddBus(const string& bus, const vector<string>& stops) {
-        buses_to_stops_[bus] = stops;
-        for (const string& stop: stops) {
-            stops_to_buses_[stop].insert(bus);
-        }
+        AddRoute(bus, stops);
+    }
+
+    // Same as above for names that point into a scanned input
+    void AddBus(string_view bus, const vector<string_view>& stops) {
+        AddRoute(bus, stops);
     }
 
     BusesForStopResponse GetBusesForStop(const string& stop) const {
         BusesForStopResponse response;
-        vector<string> message;
-        if (stops_to_buses_.count(stop) != 0) {
-            int len = stops_to_buses_.at(stop).size();
-            for (const string& bus: stops_to_buses_.at(stop)) {
-                bus != *prev(stops_to_buses_.at(stop).end())
-                ? message.push_back(bus)
-                : message.push_back(bus + "\n"s);
+        string message;
+        RenderBusesForStop(stop, message);
+        response.response_message.push_back(message);
+        return response;
+    }
+
+    StopsForBusResponse GetStopsForBus(const string& bus) const {
+        StopsForBusResponse response;
+        string message;
+        RenderStopsForBus(bus, message);
+        response.response_message.push_back(message);
+        return response;
+    }
+
+    AllBusesResponse GetAllBuses() const {
+        AllBusesResponse response;
+        string message;
+        RenderAllBuses(message);
+        response.response_message.push_back(message);
+        return response;
+    }
+
+    JourneyResponse GetJourney(const string& from, const string& to) const {
+        JourneyResponse response;
+        string message;
+        RenderJourney(from, to, message);
+        response.response_message.push_back(message);
+        return response;
+    }
+
+    // The Render methods append the text the matching response prints
+    // straight to out, without building the word vectors
+
+    // Answers for known stops and buses come from the response cache when
+    // possible, which these two update. To run them on several threads at
+    // once, give each thread its own cache_log and pass the logs to
+    // ApplyResponseCacheLog once all are done; no AddBus may run meanwhile
+
+    void RenderBusesForStop(string_view stop, string& out, ResponseCache::Log* cache_log = nullptr) const {
+        const int stop_id = stop_names_.Find(stop);
+        if (stop_id == NameTable::NO_NAME) {
+            out += "No stop\n"sv;
+            return;
+        }
+        RenderCached(ResponseCache::Kind::BusesForStop, stop_id, out, cache_log);
+    }
+
+    void RenderStopsForBus(string_view bus, string& out, ResponseCache::Log* cache_log = nullptr) const {
+        const int bus_id = bus_names_.Find(bus);
+        if (bus_id == NameTable::NO_NAME) {
+            out += "No bus\n"sv;
+            return;
+        }
+        RenderCached(ResponseCache::Kind::StopsForBus, bus_id, out, cache_log);
+    }
+
+    void ApplyResponseCacheLog(ResponseCache::Log& cache_log) {
+        response_cache_.Apply(cache_log);
+    }
+
+    // A limit of 0 turns the cache off
+    void SetResponseCacheSize(size_t max_bytes) {
+        response_cache_.SetMaxBytes(max_bytes);
+    }
+
+    ResponseCacheStats GetResponseCacheStats() const {
+        return response_cache_.GetStats();
+    }
+
+    // Writes the network to a binary snapshot: name tables, routes and
+    // the stop and transfer adjacency, with pending edges merged in
+    void SaveSnapshot(const string& path) const {
+        const int bus_count = bus_names_.GetSize();
+        const int stop_count = stop_names_.GetSize();
+        SnapshotHeader header = {};
+        memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+        header.version = SNAPSHOT_VERSION;
+        header.bus_count = bus_count;
+        header.stop_count = stop_count;
+
+        vector<uint32_t> words;
+        const auto append_name_offsets = [&words](const NameTable& names) {
+            uint32_t offset = 0;
+            words.push_back(offset);
+            for (int id = 0; id < names.GetSize(); ++id) {
+                offset += names.GetName(id).size();
+                words.push_back(offset);
+            }
+            return offset;
+        };
+        header.bus_name_bytes = append_name_offsets(bus_names_);
+        header.stop_name_bytes = append_name_offsets(stop_names_);
+        words.insert(words.end(), buses_by_name_.begin(), buses_by_name_.end());
+
+        // Routes are written back to back, dropping replaced ones
+        words.push_back(0);
+        for (const auto& [route_begin, route_end]: routes_) {
+            header.route_stop_count += route_end - route_begin;
+            words.push_back(header.route_stop_count);
+        }
+        for (const auto& [route_begin, route_end]: routes_) {
+            words.insert(words.end(), route_stops_.begin() + route_begin, route_stops_.begin() + route_end);
+        }
+
+        words.push_back(0);
+        for (int stop_id = 0; stop_id < stop_count; ++stop_id) {
+            header.stop_bus_count += CountBusesAtStop(stop_id);
+            words.push_back(header.stop_bus_count);
+        }
+        for (int stop_id = 0; stop_id < stop_count; ++stop_id) {
+            ForEachBusAtStop(stop_id, [&words](int bus_id) { words.push_back(bus_id); });
+        }
+
+        words.push_back(0);
+        for (const vector<int>& neighbours: transfers_) {
+            header.transfer_count += neighbours.size();
+            words.push_back(header.transfer_count);
+        }
+        for (const vector<int>& neighbours: transfers_) {
+            words.insert(words.end(), neighbours.begin(), neighbours.end());
+        }
+
+        ofstream out(path, ios::binary);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(words.data()), words.size() * sizeof(uint32_t));
+        for (const NameTable* names: {&bus_names_, &stop_names_}) {
+            for (int id = 0; id < names->GetSize(); ++id) {
+                out << names->GetName(id);
+            }
+        }
+        if (!out) {
+            throw runtime_error("cannot write "s + path);
+        }
+    }
+
+    // Replaces the network with the one in a snapshot. The file is mapped
+    // and its arrays are copied as they are, so nothing is sorted or
+    // merged again. Throws invalid_argument if the file is not a valid
+    // snapshot of this version
+    void LoadSnapshot(const string& path) {
+        const InputBuffer file(path);
+        const string_view data = file.GetView();
+        SnapshotHeader header;
+        if (data.size() < sizeof(header)) {
+            throw invalid_argument("truncated snapshot"s);
+        }
+        memcpy(&header, data.data(), sizeof(header));
+        if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 || header.version != SNAPSHOT_VERSION) {
+            throw invalid_argument("not a bus snapshot of version "s + to_string(SNAPSHOT_VERSION));
+        }
+        const uint64_t bus_count = header.bus_count;
+        const uint64_t stop_count = header.stop_count;
+        const uint64_t word_count = (bus_count + 1) + (stop_count + 1) + bus_count
+            + (bus_count + 1) + header.route_stop_count
+            + (stop_count + 1) + header.stop_bus_count
+            + (bus_count + 1) + header.transfer_count;
+        if (data.size() != sizeof(header) + word_count * sizeof(uint32_t)
+                            + header.bus_name_bytes + header.stop_name_bytes) {
+            throw invalid_argument("snapshot size does not match its header"s);
+        }
+
+        // The header keeps the words 4-byte aligned in the mapping
+        const uint32_t* words = reinterpret_cast<const uint32_t*>(data.data() + sizeof(header));
+        const auto take = [&words](uint64_t count) {
+            const uint32_t* array = words;
+            words += count;
+            return array;
+        };
+        const auto check = [](bool condition) {
+            if (!condition) {
+                throw invalid_argument("corrupted snapshot"s);
+            }
+        };
+        // Offsets must start at 0, never decrease and end at total
+        const auto check_offsets = [&check](const uint32_t* offsets, uint64_t count, uint64_t total) {
+            check(offsets[0] == 0 && offsets[count] == total);
+            check(is_sorted(offsets, offsets + count + 1));
+        };
+        const auto check_ids = [&check](const uint32_t* ids, uint64_t count, uint64_t limit) {
+            check(all_of(ids, ids + count, [limit](uint32_t id) { return id < limit; }));
+        };
+
+        const uint32_t* bus_name_offsets = take(bus_count + 1);
+        const uint32_t* stop_name_offsets = take(stop_count + 1);
+        const uint32_t* buses_by_name = take(bus_count);
+        const uint32_t* route_offsets = take(bus_count + 1);
+        const uint32_t* route_stops = take(header.route_stop_count);
+        const uint32_t* stop_bus_offsets = take(stop_count + 1);
+        const uint32_t* stop_buses = take(header.stop_bus_count);
+        const uint32_t* transfer_offsets = take(bus_count + 1);
+        const uint32_t* transfers = take(header.transfer_count);
+        const char* bus_name_bytes = reinterpret_cast<const char*>(words);
+        const char* stop_name_bytes = bus_name_bytes + header.bus_name_bytes;
+
+        check_offsets(bus_name_offsets, bus_count, header.bus_name_bytes);
+        check_offsets(stop_name_offsets, stop_count, header.stop_name_bytes);
+        check_offsets(route_offsets, bus_count, header.route_stop_count);
+        check_offsets(stop_bus_offsets, stop_count, header.stop_bus_count);
+        check_offsets(transfer_offsets, bus_count, header.transfer_count);
+        check_ids(buses_by_name, bus_count, bus_count);
+        check_ids(route_stops, header.route_stop_count, stop_count);
+        check_ids(stop_buses, header.stop_bus_count, bus_count);
+        check_ids(transfers, header.transfer_count, bus_count);
+
+        NameTable bus_names;
+        NameTable stop_names;
+        const auto load_names = [&check](NameTable& names, const char* bytes, const uint32_t* offsets, uint64_t count) {
+            names.Reserve(count);
+            for (uint64_t id = 0; id < count; ++id) {
+                // A repeated name would give two ids one name
+                check(names.Intern({bytes + offsets[id], offsets[id + 1] - offsets[id]}) == static_cast<int>(id));
+            }
+        };
+        load_names(bus_names, bus_name_bytes, bus_name_offsets, bus_count);
+        load_names(stop_names, stop_name_bytes, stop_name_offsets, stop_count);
+
+        bus_names_ = move(bus_names);
+        stop_names_ = move(stop_names);
+        buses_by_name_.assign(buses_by_name, buses_by_name + bus_count);
+        routes_.resize(bus_count);
+        transfers_.resize(bus_count);
+        for (uint64_t bus_id = 0; bus_id < bus_count; ++bus_id) {
+            routes_[bus_id] = {route_offsets[bus_id], route_offsets[bus_id + 1]};
+            transfers_[bus_id].assign(transfers + transfer_offsets[bus_id], transfers + transfer_offsets[bus_id + 1]);
+        }
+        route_stops_.assign(route_stops, route_stops + header.route_stop_count);
+        dead_route_stop_count_ = 0;
+        stop_bus_offsets_.assign(stop_bus_offsets, stop_bus_offsets + stop_count + 1);
+        stop_buses_.assign(stop_buses, stop_buses + header.stop_bus_count);
+        pending_stop_buses_.clear();
+        pending_edge_count_ = 0;
+        response_cache_.Clear();
+    }
+
+    void RenderAllBuses(string& out) const {
+        if (buses_by_name_.empty()) {
+            out += "No buses\n"sv;
+            return;
+        }
+
+        const int last_bus_id = buses_by_name_.back();
+        const auto [last_begin, last_end] = routes_[last_bus_id];
+        ResponseWriter writer = last_begin != last_end
+            ? ResponseWriter(out, stop_names_.GetName(route_stops_[last_end - 1]), "\n"sv)
+            : ResponseWriter(out, bus_names_.GetName(last_bus_id), ":"sv);
+
+        for (const int bus_id: buses_by_name_) {
+            writer.Write("Bus"sv);
+            writer.Write(bus_names_.GetName(bus_id), ":"sv);
+            const auto [route_begin, route_end] = routes_[bus_id];
+            for (int i = route_begin; i < route_end; ++i) {
+                writer.Write(stop_names_.GetName(route_stops_[i]),
+                             route_stops_[i] != route_stops_[route_end - 1] ? ""sv : "\n"sv);
+            }
+        }
+    }
+
+    // Lists the buses to take from one stop to another with the fewest
+    // transfers, in the order they are ridden
+    void RenderJourney(string_view from, string_view to, string& out) const {
+        const int from_stop_id = stop_names_.Find(from);
+        const int to_stop_id = stop_names_.Find(to);
+        if (from_stop_id == NameTable::NO_NAME || to_stop_id == NameTable::NO_NAME) {
+            out += "No stop\n"sv;
+            return;
+        }
+        if (from_stop_id == to_stop_id) {
+            out += "Same stop\n"sv;
+            return;
+        }
+
+        const vector<int> bus_ids = FindJourney(from_stop_id, to_stop_id);
+        if (bus_ids.empty()) {
+            out += "No route\n"sv;
+            return;
+        }
+        ResponseWriter writer(out, bus_names_.GetName(bus_ids.back()), "\n"sv);
+        for (size_t i = 0; i < bus_ids.size(); ++i) {
+            writer.Write(bus_names_.GetName(bus_ids[i]), i + 1 != bus_ids.size() ? ""sv : "\n"sv);
+        }
+    }
+
+private:
+    NameTable bus_names_;
+    NameTable stop_names_;
+    // Bus ids ordered by name
+    vector<int> buses_by_name_;
+    // Bus id -> ids of the buses sharing a stop with it, sorted by id
+    vector<vector<int>> transfers_;
+    mutable ResponseCache response_cache_{RESPONSE_CACHE_SIZE};
+
+    // Bus id -> [begin, end) of its route in route_stops_. A re-added bus
+    // gets a new range; the old one is dropped on compaction
+    vector<pair<int, int>> routes_;
+    vector<int> route_stops_;
+    size_t dead_route_stop_count_ = 0;
+
+    // Stop id -> its buses sorted by name, in compressed sparse rows:
+    // stop_buses_[stop_bus_offsets_[s]..stop_bus_offsets_[s + 1]).
+    // Edges added since the last compaction wait in pending_stop_buses_
+    vector<int> stop_bus_offsets_ = {0};
+    vector<int> stop_buses_;
+    unordered_map<int, vector<int>> pending_stop_buses_;
+    size_t pending_edge_count_ = 0;
+
+    vector<int>::iterator LowerBoundByName(vector<int>::iterator first, vector<int>::iterator last, string_view bus) const {
+        return lower_bound(first, last, bus, [this](int bus_id, string_view name) {
+            return bus_names_.GetName(bus_id) < name;
+        });
+    }
+
+    template <typename StopNames>
+    void AddRoute(string_view bus, const StopNames& stops) {
+        const int bus_id = bus_names_.Intern(bus);
+        if (bus_id == static_cast<int>(routes_.size())) {
+            routes_.push_back({0, 0});
+            transfers_.emplace_back();
+            buses_by_name_.insert(LowerBoundByName(buses_by_name_.begin(), buses_by_name_.end(), bus), bus_id);
+        }
+        else {
+            dead_route_stop_count_ += routes_[bus_id].second - routes_[bus_id].first;
+        }
+        response_cache_.Invalidate(ResponseCache::Kind::StopsForBus, bus_id);
+
+        const int route_begin = route_stops_.size();
+        for (const auto& stop: stops) {
+            const int stop_id = stop_names_.Intern(stop);
+            route_stops_.push_back(stop_id);
+            if (!HasBusAtStop(stop_id, bus_id)) {
+                // The stop gets a new bus: its answer and the interchange
+                // lists of the buses already there change
+                response_cache_.Invalidate(ResponseCache::Kind::BusesForStop, stop_id);
+                ForEachBusAtStop(stop_id, [&](int other_bus_id) {
+                    AddTransfer(bus_id, other_bus_id);
+                    response_cache_.Invalidate(ResponseCache::Kind::StopsForBus, other_bus_id);
+                });
+                vector<int>& pending = pending_stop_buses_[stop_id];
+                pending.insert(LowerBoundByName(pending.begin(), pending.end(), bus), bus_id);
+                ++pending_edge_count_;
             }
-            response.response_message = message;
-            return response;
+        }
+        routes_[bus_id] = {route_begin, static_cast<int>(route_stops_.size())};
+
+        if (pending_edge_count_ + dead_route_stop_count_
+            >= max(MIN_PENDING_EDGES_TO_COMPACT, (stop_buses_.size() + route_stops_.size()) / 4)) {
+            Compact();
+        }
+    }
+
+    void RenderCached(ResponseCache::Kind kind, int id, string& out, ResponseCache::Log* cache_log) const {
+        if (cache_log != nullptr ? response_cache_.AppendTo(kind, id, out, *cache_log)
+                                 : response_cache_.AppendTo(kind, id, out)) {
+            return;
+        }
+        const size_t response_begin = out.size();
+        if (kind == ResponseCache::Kind::BusesForStop) {
+            RenderBusesForStopId(id, out);
         }
         else {
-            response.response_message.push_back("No stop\n"s);
-            return response;
+            RenderStopsForBusId(id, out);
+        }
+        const string_view response = string_view(out).substr(response_begin);
+        if (cache_log != nullptr) {
+            response_cache_.Insert(kind, id, response, *cache_log);
+        }
+        else {
+            response_cache_.Insert(kind, id, response);
         }
     }
 
-    StopsForBusResponse GetStopsForBus(const string& bus) const {
-        StopsForBusResponse response;
-        vector<string> message;
-        if (buses_to_stops_.count(bus) != 0) {
-            for (const string& stop: buses_to_stops_.at(bus)){
-                message.push_back("Stop"s);
-                message.push_back(stop + ":"s);
-
-                if (stops_to_buses_.at(stop).size() == 1) {
-                    message.push_back("no interchange\n"s);
-                }
-                else {
-                    int len = stops_to_buses_.at(stop).size();
-                    for (const string& other_bus: stops_to_buses_.at(stop)) {
-                        if (bus != other_bus) {
-                            other_bus != *prev(stops_to_buses_.at(stop).end())
-                            ? message.push_back(other_bus)
-                            : message.push_back(other_bus + "\n"s);
-                        }
-                        else {
-                            if (other_bus == *prev(stops_to_buses_.at(stop).end())) {
-                                message.at(message.size() - 1) += "\n";
-                            }
-                        }
+    void RenderBusesForStopId(int stop_id, string& out) const {
+        const int last_bus_id = GetLastBusAtStop(stop_id);
+        ResponseWriter writer(out, bus_names_.GetName(last_bus_id), "\n"sv);
+        ForEachBusAtStop(stop_id, [&](int bus_id) {
+            writer.Write(bus_names_.GetName(bus_id), bus_id != last_bus_id ? ""sv : "\n"sv);
+        });
+    }
+
+    void RenderStopsForBusId(int bus_id, string& out) const {
+        const auto [route_begin, route_end] = routes_[bus_id];
+        if (route_begin == route_end) {
+            return;
+        }
+
+        // The response ends with the line of the last stop
+        const int last_stop_id = route_stops_[route_end - 1];
+        ResponseWriter writer = CountBusesAtStop(last_stop_id) == 1
+            ? ResponseWriter(out, "no interchange\n"sv, ""sv)
+            : ResponseWriter(out, bus_names_.GetName(GetLastOtherBusAtStop(last_stop_id, bus_id)), "\n"sv);
+
+        for (int i = route_begin; i < route_end; ++i) {
+            const int stop_id = route_stops_[i];
+            writer.Write("Stop"sv);
+            writer.Write(stop_names_.GetName(stop_id), ":"sv);
+
+            if (CountBusesAtStop(stop_id) == 1) {
+                writer.Write("no interchange\n"sv);
+            }
+            else {
+                // Each bus is written once the next one is known, so the
+                // last of them gets the newline
+                int previous_bus_id = NameTable::NO_NAME;
+                ForEachBusAtStop(stop_id, [&](int other_bus_id) {
+                    if (other_bus_id == bus_id) {
+                        return;
                     }
-                }
+                    if (previous_bus_id != NameTable::NO_NAME) {
+                        writer.Write(bus_names_.GetName(previous_bus_id));
+                    }
+                    previous_bus_id = other_bus_id;
+                });
+                writer.Write(bus_names_.GetName(previous_bus_id), "\n"sv);
             }
-            response.response_message = message;
-            return response;
         }
-        else {
-            message.push_back("No bus\n");
-            response.response_message = message;
-            return response;
+    }
+
+    void AddTransfer(int first_bus_id, int second_bus_id) {
+        for (const auto& [from, to]: {pair{first_bus_id, second_bus_id}, pair{second_bus_id, first_bus_id}}) {
+            vector<int>& neighbours = transfers_[from];
+            const auto it = lower_bound(neighbours.begin(), neighbours.end(), to);
+            if (it == neighbours.end() || *it != to) {
+                neighbours.insert(it, to);
+            }
         }
     }
 
-    AllBusesResponse GetAllBuses() const {
-        AllBusesResponse response;
+    // Bidirectional BFS over the transfer graph, growing the smaller side
+    // by a whole level at a time. Returns no buses if B is unreachable
+    vector<int> FindJourney(int from_stop_id, int to_stop_id) const {
+        const int not_seen = -1;
+        const int bus_count = bus_names_.GetSize();
+        // Distance in rides from each end, and the bus a bus was reached from
+        vector<int> forward_distance(bus_count, not_seen);
+        vector<int> backward_distance(bus_count, not_seen);
+        vector<int> forward_parent(bus_count, not_seen);
+        vector<int> backward_parent(bus_count, not_seen);
 
-        vector<string> message;
-        if (buses_to_stops_.size() != 0) {
-            for (auto& [bus, stops]: buses_to_stops_) {
-                message.push_back("Bus");
-                message.push_back(bus + ":");
-                for (string stop: stops) {
-                    stop != stops.at(stops.size() - 1)
-                    ? message.push_back(stop)
-                    : message.push_back(stop + "\n"s);
+        vector<int> forward_frontier;
+        ForEachBusAtStop(from_stop_id, [&](int bus_id) {
+            forward_distance[bus_id] = 0;
+            forward_parent[bus_id] = bus_id;
+            forward_frontier.push_back(bus_id);
+        });
+        vector<int> backward_frontier;
+        int meeting_bus_id = not_seen;
+        ForEachBusAtStop(to_stop_id, [&](int bus_id) {
+            backward_distance[bus_id] = 0;
+            backward_parent[bus_id] = bus_id;
+            backward_frontier.push_back(bus_id);
+            if (meeting_bus_id == not_seen && forward_distance[bus_id] == 0) {
+                meeting_bus_id = bus_id;
+            }
+        });
+
+        while (meeting_bus_id == not_seen && !forward_frontier.empty() && !backward_frontier.empty()) {
+            const bool is_forward = forward_frontier.size() <= backward_frontier.size();
+            vector<int>& frontier = is_forward ? forward_frontier : backward_frontier;
+            vector<int>& distance = is_forward ? forward_distance : backward_distance;
+            vector<int>& parent = is_forward ? forward_parent : backward_parent;
+            const vector<int>& other_distance = is_forward ? backward_distance : forward_distance;
+
+            // Every meeting in this level is checked, as they may lie at
+            // different distances from the other end
+            int best_length = numeric_limits<int>::max();
+            vector<int> next_frontier;
+            for (const int bus_id: frontier) {
+                for (const int next_bus_id: transfers_[bus_id]) {
+                    if (distance[next_bus_id] != not_seen) {
+                        continue;
+                    }
+                    distance[next_bus_id] = distance[bus_id] + 1;
+                    parent[next_bus_id] = bus_id;
+                    next_frontier.push_back(next_bus_id);
+                    if (other_distance[next_bus_id] != not_seen
+                        && distance[next_bus_id] + other_distance[next_bus_id] < best_length) {
+                        best_length = distance[next_bus_id] + other_distance[next_bus_id];
+                        meeting_bus_id = next_bus_id;
+                    }
                 }
             }
+            frontier = move(next_frontier);
         }
-        else {
-            message.push_back("No buses\n"s);
+
+        vector<int> bus_ids;
+        if (meeting_bus_id == not_seen) {
+            return bus_ids;
         }
+        for (int bus_id = meeting_bus_id; ; bus_id = forward_parent[bus_id]) {
+            bus_ids.push_back(bus_id);
+            if (forward_parent[bus_id] == bus_id) {
+                break;
+            }
+        }
+        reverse(bus_ids.begin(), bus_ids.end());
+        for (int bus_id = meeting_bus_id; backward_parent[bus_id] != bus_id; ) {
+            bus_id = backward_parent[bus_id];
+            bus_ids.push_back(bus_id);
+        }
+        return bus_ids;
+    }
 
-        response.response_message = message;
-        return response;
+    pair<const int*, const int*> GetCompactedRow(int stop_id) const {
+        if (stop_id + 1 >= static_cast<int>(stop_bus_offsets_.size())) {
+            return {nullptr, nullptr};
+        }
+        return {stop_buses_.data() + stop_bus_offsets_[stop_id], stop_buses_.data() + stop_bus_offsets_[stop_id + 1]};
+    }
+
+    const vector<int>* GetPendingRow(int stop_id) const {
+        const auto it = pending_stop_buses_.find(stop_id);
+        return it != pending_stop_buses_.end() ? &it->second : nullptr;
+    }
+
+    bool IsBusNameLess(int lhs, int rhs) const {
+        return bus_names_.GetName(lhs) < bus_names_.GetName(rhs);
+    }
+
+    // Visits the buses of a stop in name order, merging the compacted
+    // row with the pending one
+    template <typename Callback>
+    void ForEachBusAtStop(int stop_id, Callback callback) const {
+        auto [first, last] = GetCompactedRow(stop_id);
+        const vector<int>* pending = GetPendingRow(stop_id);
+        if (pending == nullptr) {
+            for (; first != last; ++first) {
+                callback(*first);
+            }
+            return;
+        }
+        auto it = pending->begin();
+        while (first != last || it != pending->end()) {
+            if (it == pending->end() || (first != last && IsBusNameLess(*first, *it))) {
+                callback(*first++);
+            }
+            else {
+                callback(*it++);
+            }
+        }
+    }
+
+    size_t CountBusesAtStop(int stop_id) const {
+        const auto [first, last] = GetCompactedRow(stop_id);
+        const vector<int>* pending = GetPendingRow(stop_id);
+        return (last - first) + (pending != nullptr ? pending->size() : 0);
+    }
+
+    int GetLastOtherBusAtStop(int stop_id, int bus_id) const {
+        int last_other_bus_id = NameTable::NO_NAME;
+        ForEachBusAtStop(stop_id, [&](int other_bus_id) {
+            if (other_bus_id != bus_id) {
+                last_other_bus_id = other_bus_id;
+            }
+        });
+        return last_other_bus_id;
+    }
+
+    int GetLastBusAtStop(int stop_id) const {
+        const auto [first, last] = GetCompactedRow(stop_id);
+        const vector<int>* pending = GetPendingRow(stop_id);
+        if (pending == nullptr) {
+            return *prev(last);
+        }
+        if (first == last || IsBusNameLess(*prev(last), pending->back())) {
+            return pending->back();
+        }
+        return *prev(last);
+    }
+
+    bool HasBusAtStop(int stop_id, int bus_id) const {
+        const string& bus = bus_names_.GetName(bus_id);
+        const auto [first, last] = GetCompactedRow(stop_id);
+        const int* row_it = lower_bound(first, last, bus, [this](int id, const string& name) {
+            return bus_names_.GetName(id) < name;
+        });
+        if (row_it != last && *row_it == bus_id) {
+            return true;
+        }
+        const vector<int>* pending = GetPendingRow(stop_id);
+        return pending != nullptr && binary_search(pending->begin(), pending->end(), bus_id,
+                                                    [this](int lhs, int rhs) { return IsBusNameLess(lhs, rhs); });
+    }
+
+    // Merges pending edges into the stop rows and drops replaced routes
+    void Compact() {
+        vector<int> bus_rank(bus_names_.GetSize());
+        for (size_t i = 0; i < buses_by_name_.size(); ++i) {
+            bus_rank[buses_by_name_[i]] = i;
+        }
+        const auto by_rank = [&bus_rank](int lhs, int rhs) { return bus_rank[lhs] < bus_rank[rhs]; };
+
+        vector<int> offsets = {0};
+        vector<int> buses;
+        offsets.reserve(stop_names_.GetSize() + 1);
+        buses.reserve(stop_buses_.size() + pending_edge_count_);
+        for (int stop_id = 0; stop_id < stop_names_.GetSize(); ++stop_id) {
+            const auto [first, last] = GetCompactedRow(stop_id);
+            const vector<int>* pending = GetPendingRow(stop_id);
+            if (pending != nullptr) {
+                merge(first, last, pending->begin(), pending->end(), back_inserter(buses), by_rank);
+            }
+            else {
+                buses.insert(buses.end(), first, last);
+            }
+            offsets.push_back(buses.size());
+        }
+        stop_bus_offsets_ = move(offsets);
+        stop_buses_ = move(buses);
+        pending_stop_buses_.clear();
+        pending_edge_count_ = 0;
+
+        vector<int> route_stops;
+        route_stops.reserve(route_stops_.size() - dead_route_stop_count_);
+        for (auto& [route_begin, route_end]: routes_) {
+            const int new_begin = route_stops.size();
+            route_stops.insert(route_stops.end(), route_stops_.begin() + route_begin, route_stops_.begin() + route_end);
+            route_begin = new_begin;
+            route_end = route_stops.size();
+        }
+        route_stops_ = move(route_stops);
+        dead_route_stop_count_ = 0;
+    }
+};
+
+// Runs one job on a fixed set of threads and waits until every thread
+// is done with it. The calling thread works as worker 0
+class WorkerPool {
+public:
+    explicit WorkerPool(int thread_count) {
+        for (int i = 1; i < thread_count; ++i) {
+            threads_.emplace_back([this, i] { WorkerLoop(i); });
+        }
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    ~WorkerPool() {
+        {
+            const lock_guard guard(mutex_);
+            is_stopping_ = true;
+        }
+        start_condition_.notify_all();
+        for (thread& worker: threads_) {
+            worker.join();
+        }
+    }
+
+    int GetThreadCount() const {
+        return threads_.size() + 1;
+    }
+
+    // Calls job(worker_index) once on each worker
+    void Run(const function<void(int)>& job) {
+        {
+            const lock_guard guard(mutex_);
+            job_ = &job;
+            running_count_ = threads_.size();
+            ++generation_;
+        }
+        start_condition_.notify_all();
+        job(0);
+        unique_lock lock(mutex_);
+        done_condition_.wait(lock, [this] { return running_count_ == 0; });
+        job_ = nullptr;
     }
 
 private:
-    map<string, vector<string>> buses_to_stops_;
-    map<string, set<string>> stops_to_buses_;
+    vector<thread> threads_;
+    mutex mutex_;
+    condition_variable start_condition_;
+    condition_variable done_condition_;
+    const function<void(int)>* job_ = nullptr;
+    uint64_t generation_ = 0;
+    size_t running_count_ = 0;
+    bool is_stopping_ = false;
+
+    void WorkerLoop(int index) {
+        uint64_t seen_generation = 0;
+        while (true) {
+            const function<void(int)>* job;
+            {
+                unique_lock lock(mutex_);
+                start_condition_.wait(lock, [&] { return is_stopping_ || generation_ != seen_generation; });
+                if (is_stopping_) {
+                    return;
+                }
+                seen_generation = generation_;
+                job = job_;
+            }
+            (*job)(index);
+            {
+                const lock_guard guard(mutex_);
+                --running_count_;
+            }
+            done_condition_.notify_one();
+        }
+    }
 };
 
+// Read queries are grouped into runs of at most this many; shorter runs
+// than MIN_PARALLEL_READS are not worth waking the workers for. A read
+// takes about 0.8 us and waking the workers and applying their cache
+// logs a few us, which evens out at 3 to 20 reads on two threads
+const size_t MAX_READ_BATCH = 4096;
+const size_t MIN_PARALLEL_READS = 16;
+
+void RenderReadQuery(const BusManager& bm, const QueryView& q, string& out, ResponseCache::Log* cache_log) {
+    switch (q.type) {
+        case QueryType::BusesForStop:
+            bm.RenderBusesForStop(q.stop, out, cache_log);
+            break;
+        case QueryType::StopsForBus:
+            bm.RenderStopsForBus(q.bus, out, cache_log);
+            break;
+        case QueryType::AllBuses:
+            bm.RenderAllBuses(out);
+            break;
+        case QueryType::Journey:
+            bm.RenderJourney(q.stop, q.destination, out);
+            break;
+        case QueryType::NewBus:
+            break;
+    }
+    out += '\n';
+}
+
+// Answers the queries of input against bm and writes the answers to
+// out in input order. NEW_BUS is a write barrier: the read queries between two of
+// them see one unchanging network, so with several threads each worker
+// renders a contiguous share of the run into its own buffer and the
+// buffers are appended in order. Workers only read the response cache
+// and log their changes to it, which are applied after the run. The
+// bytes do not depend on thread_count
+void ProcessQueries(string_view input, BusManager& bm, ostream& out, int thread_count) {
+    QueryScanner scanner(input);
+    const int query_count = scanner.ReadNumber();
+
+    WorkerPool pool(thread_count);
+    vector<string> worker_outputs(pool.GetThreadCount());
+    vector<ResponseCache::Log> cache_logs(pool.GetThreadCount());
+    vector<QueryView> reads;
+    string output;
+    output.reserve(OUTPUT_BUFFER_SIZE);
+
+    const auto answer_reads = [&] {
+        if (reads.size() < MIN_PARALLEL_READS || pool.GetThreadCount() == 1) {
+            for (const QueryView& read: reads) {
+                RenderReadQuery(bm, read, output, nullptr);
+            }
+        }
+        else {
+            pool.Run([&](int worker_index) {
+                const size_t begin = reads.size() * worker_index / worker_outputs.size();
+                const size_t end = reads.size() * (worker_index + 1) / worker_outputs.size();
+                string& worker_output = worker_outputs[worker_index];
+                worker_output.clear();
+                for (size_t i = begin; i < end; ++i) {
+                    RenderReadQuery(bm, reads[i], worker_output, &cache_logs[worker_index]);
+                }
+            });
+            for (const string& worker_output: worker_outputs) {
+                output += worker_output;
+            }
+            for (ResponseCache::Log& cache_log: cache_logs) {
+                bm.ApplyResponseCacheLog(cache_log);
+            }
+        }
+        reads.clear();
+        if (output.size() >= OUTPUT_BUFFER_SIZE) {
+            out.write(output.data(), output.size());
+            output.clear();
+        }
+    };
+
+    QueryView q;
+    for (int i = 0; i < query_count && scanner.Read(q); ++i) {
+        if (q.type == QueryType::NewBus) {
+            answer_reads();
+            bm.AddBus(q.bus, q.stops);
+            output += '\n';
+            continue;
+        }
+        reads.push_back({q.type, q.bus, q.stop, q.destination, {}});
+        if (reads.size() == MAX_READ_BATCH) {
+            answer_reads();
+        }
+    }
+    answer_reads();
+    out.write(output.data(), output.size());
+}
+
 string ToString(const vector<string>& vector_string) {
     size_t len = vector_string.size();
     string message;
@@ -337,38 +1544,482 @@ void TestGetBusesForStop() {
     cout << "TestGetBusesForStop is OK"s << endl;
 }
 
+void TestManyBuses() {
+    BusManager bm;
+
+    // Enough routes to merge pending stops into the compacted rows
+    set<string> bus_names;
+    for (int i = 0; i < 300; ++i) {
+        const string bus_name = "B"s + to_string(i);
+        bm.AddBus(bus_name, {"Stop"s + to_string(i % 7), "Common"s});
+        bus_names.insert(bus_name);
+    }
+
+    string expected;
+    for (const string& bus_name: bus_names) {
+        expected += bus_name + " "s;
+    }
+    expected.back() = '\n';
+    assert(ToString(bm.GetBusesForStop("Common"s).response_message) == expected);
+
+    // A re-added bus keeps its old stops but lists only the new route
+    bm.AddBus("B0"s, {"Terminal"s});
+    assert(ToString(bm.GetStopsForBus("B0"s).response_message) == "Stop Terminal: no interchange\n"s);
+    assert(ToString(bm.GetBusesForStop("Terminal"s).response_message) == "B0\n"s);
+    assert(ToString(bm.GetBusesForStop("Common"s).response_message) == expected);
+
+    cout << "TestManyBuses is OK"s << endl;
+}
+
+void TestJourney() {
+    BusManager bm;
+    assert(ToString(bm.GetJourney("Vnukovo"s, "Skolkovo"s).response_message) == "No stop\n"s);
+
+    bm.AddBus("32"s, {"Tolstopaltsevo"s, "Marushkino"s, "Vnukovo"s});
+    bm.AddBus("32K"s, {"Tolstopaltsevo"s, "Marushkino"s, "Vnukovo"s, "Peredelkino"s, "Solntsevo"s, "Skolkovo"s});
+    bm.AddBus("950"s, {"Kokoshkino"s, "Marushkino"s, "Vnukovo"s, "Peredelkino"s, "Solntsevo"s, "Troparyovo"s});
+    bm.AddBus("272"s, {"Vnukovo"s, "Moskovsky"s, "Rumyantsevo"s, "Troparyovo"s});
+    bm.AddBus("X"s, {"Skolkovo"s, "Far"s});
+    bm.AddBus("Y"s, {"Island"s});
+
+    // One bus is enough: the first of them by name is taken
+    assert(ToString(bm.GetJourney("Tolstopaltsevo"s, "Vnukovo"s).response_message) == "32\n"s);
+    // Two transfers
+    assert(ToString(bm.GetJourney("Kokoshkino"s, "Far"s).response_message) == "950 32K X\n"s);
+    assert(ToString(bm.GetJourney("Far"s, "Moskovsky"s).response_message) == "X 32K 272\n"s);
+
+    assert(ToString(bm.GetJourney("Kokoshkino"s, "Island"s).response_message) == "No route\n"s);
+    assert(ToString(bm.GetJourney("Vnukovo"s, "Vnukovo"s).response_message) == "Same stop\n"s);
+
+    // The transfer graph follows routes added later
+    bm.AddBus("Y"s, {"Island"s, "Moskovsky"s});
+    assert(ToString(bm.GetJourney("Kokoshkino"s, "Island"s).response_message) == "950 272 Y\n"s);
+
+    cout << "TestJourney is OK"s << endl;
+}
+
+void TestResponseCache() {
+    BusManager bm;
+    bm.AddBus("32"s, {"Tolstopaltsevo"s, "Marushkino"s, "Vnukovo"s});
+    bm.AddBus("950"s, {"Kokoshkino"s, "Peredelkino"s});
+
+    string output;
+    bm.RenderStopsForBus("32"s, output);
+    bm.RenderStopsForBus("32"s, output);
+    bm.RenderBusesForStop("Kokoshkino"s, output);
+    assert(bm.GetResponseCacheStats().hits == 1);
+    assert(bm.GetResponseCacheStats().misses == 2);
+
+    // A new bus at Vnukovo changes the answer for 32, but not for Kokoshkino
+    bm.AddBus("272"s, {"Vnukovo"s, "Moskovsky"s});
+    assert(bm.GetResponseCacheStats().invalidations == 1);
+    assert(ToString(bm.GetStopsForBus("32"s).response_message) == "Stop Tolstopaltsevo: no interchange\n"
+                                                                  "Stop Marushkino: no interchange\n"
+                                                                  "Stop Vnukovo: 272\n"s);
+    output.clear();
+    bm.RenderBusesForStop("Kokoshkino"s, output);
+    assert(output == "950\n"s);
+    assert(bm.GetResponseCacheStats().hits == 2);
+
+    // The size limit is kept by evicting the least recently used answers
+    bm.SetResponseCacheSize(200);
+    assert(bm.GetResponseCacheStats().bytes <= 200);
+    assert(bm.GetResponseCacheStats().evictions > 0);
+    bm.SetResponseCacheSize(0);
+    assert(bm.GetResponseCacheStats().entries == 0);
+
+    // Concurrent readers leave the cache as it is until their logs are applied
+    bm.SetResponseCacheSize(RESPONSE_CACHE_SIZE);
+    ResponseCache::Log first_log;
+    ResponseCache::Log second_log;
+    output.clear();
+    bm.RenderBusesForStop("Vnukovo"s, output, &first_log);
+    bm.RenderBusesForStop("Vnukovo"s, output, &second_log);
+    assert(output == "272 32\n272 32\n"s);
+    assert(bm.GetResponseCacheStats().entries == 0);
+    const size_t misses = bm.GetResponseCacheStats().misses;
+    bm.ApplyResponseCacheLog(first_log);
+    bm.ApplyResponseCacheLog(second_log);
+    assert(bm.GetResponseCacheStats().entries == 1);
+    assert(bm.GetResponseCacheStats().misses == misses + 2);
+    bm.RenderBusesForStop("Vnukovo"s, output, &first_log);
+    bm.ApplyResponseCacheLog(first_log);
+    assert(bm.GetResponseCacheStats().hits == 3);
+
+    cout << "TestResponseCache is OK"s << endl;
+}
+
+void TestQueryScanner() {
+    const string input = "4\nNEW_BUS 32 3 Tolstopaltsevo Marushkino Vnukovo\n"s
+                         "BUSES_FOR_STOP Vnukovo\r\nSTOPS_FOR_BUS  32\nALL_BUSES"s;
+    QueryScanner scanner(input);
+    assert(scanner.ReadNumber() == 4);
+
+    QueryView q;
+    assert(scanner.Read(q) && q.type == QueryType::NewBus);
+    assert(q.bus == "32"sv);
+    assert(q.stops == vector<string_view>({"Tolstopaltsevo"sv, "Marushkino"sv, "Vnukovo"sv}));
+
+    assert(scanner.Read(q) && q.type == QueryType::BusesForStop && q.stop == "Vnukovo"sv);
+    assert(scanner.Read(q) && q.type == QueryType::StopsForBus && q.bus == "32"sv);
+    assert(scanner.Read(q) && q.type == QueryType::AllBuses);
+    assert(!scanner.Read(q));
+
+    // Commands are checked in full, not only by the first byte
+    QueryScanner bad_scanner("NEW_BUSES 1 0"sv);
+    bool thrown = false;
+    try {
+        bad_scanner.Read(q);
+    } catch (const out_of_range&) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    // Stop counts out of range neither throw nor allocate for the count
+    QueryScanner negative_scanner("NEW_BUS 1 -3 BUSES_FOR_STOP x"sv);
+    assert(negative_scanner.Read(q) && q.type == QueryType::NewBus && q.stops.empty());
+    assert(negative_scanner.Read(q) && q.type == QueryType::BusesForStop && q.stop == "x"sv);
+    QueryScanner huge_scanner("NEW_BUS 1 2000000000 a b"sv);
+    assert(huge_scanner.Read(q) && q.stops == vector<string_view>({"a"sv, "b"sv}));
+    assert(!huge_scanner.Read(q));
+
+    // Input without a count has no queries
+    QueryScanner empty_scanner(" \n"sv);
+    assert(empty_scanner.ReadNumber() == 0);
+    assert(!empty_scanner.Read(q));
+    QueryScanner truncated_scanner("NEW_BUS 1"sv);
+    assert(truncated_scanner.Read(q) && q.bus == "1"sv && q.stops.empty());
+
+    cout << "TestQueryScanner is OK"s << endl;
+}
+
+void TestConcurrentQueries() {
+    mt19937 generator(7);
+    ostringstream input;
+    const int query_count = 20000;
+    input << query_count << "\n"s;
+    for (int i = 0; i < query_count; ++i) {
+        const int kind = generator() % 1000;
+        if (kind < 3) {
+            const int route_size = 2 + generator() % 10;
+            input << "NEW_BUS bus"s << generator() % 200 << " "s << route_size;
+            for (int j = 0; j < route_size; ++j) {
+                input << " stop"s << generator() % 500;
+            }
+        }
+        else if (kind < 400) {
+            input << "BUSES_FOR_STOP stop"s << generator() % 500;
+        }
+        else if (kind < 800) {
+            input << "STOPS_FOR_BUS bus"s << generator() % 200;
+        }
+        else if (kind < 900) {
+            input << "JOURNEY stop"s << generator() % 500 << " stop"s << generator() % 500;
+        }
+        else {
+            input << "ALL_BUSES"s;
+        }
+        input << "\n"s;
+    }
+
+    // Answers do not depend on how many threads render them
+    ostringstream sequential;
+    BusManager sequential_bm;
+    ProcessQueries(input.str(), sequential_bm, sequential, 1);
+    for (const int thread_count: {2, 3, 8}) {
+        ostringstream concurrent;
+        BusManager concurrent_bm;
+        ProcessQueries(input.str(), concurrent_bm, concurrent, thread_count);
+        assert(concurrent.str() == sequential.str());
+    }
+
+    cout << "TestConcurrentQueries is OK"s << endl;
+}
+
+// Renders every answer the text protocol can give about the network
+string RenderEverything(const BusManager& bm, int stop_count, int bus_count) {
+    string out;
+    bm.RenderAllBuses(out);
+    for (int i = 0; i < stop_count; ++i) {
+        bm.RenderBusesForStop("stop"s + to_string(i), out);
+        for (int j = 0; j < stop_count; j += 7) {
+            bm.RenderJourney("stop"s + to_string(i), "stop"s + to_string(j), out);
+        }
+    }
+    for (int i = 0; i < bus_count; ++i) {
+        bm.RenderStopsForBus("bus"s + to_string(i), out);
+    }
+    return out;
+}
+
+void TestSnapshot() {
+    const int stop_count = 60;
+    const int bus_count = 30;
+    mt19937 generator(11);
+    const auto add_random_bus = [&generator](BusManager& bm) {
+        vector<string> stops(1 + generator() % 6);
+        for (string& stop: stops) {
+            stop = "stop"s + to_string(generator() % stop_count);
+        }
+        bm.AddBus("bus"s + to_string(generator() % bus_count), stops);
+    };
+
+    // Enough buses, some of them re-added, to leave both compacted and
+    // pending edges and replaced routes behind
+    BusManager bm;
+    for (int i = 0; i < 100; ++i) {
+        add_random_bus(bm);
+    }
+    const string path = (filesystem::temp_directory_path() / "bus-snapshot-test.bin").string();
+    bm.SaveSnapshot(path);
+
+    BusManager loaded;
+    loaded.AddBus("bus0"s, {"elsewhere"s});
+    loaded.LoadSnapshot(path);
+    assert(RenderEverything(loaded, stop_count, bus_count) == RenderEverything(bm, stop_count, bus_count));
+
+    // The loaded network keeps growing the same way
+    mt19937 saved_generator = generator;
+    for (int i = 0; i < 50; ++i) {
+        add_random_bus(bm);
+    }
+    generator = saved_generator;
+    for (int i = 0; i < 50; ++i) {
+        add_random_bus(loaded);
+    }
+    assert(RenderEverything(loaded, stop_count, bus_count) == RenderEverything(bm, stop_count, bus_count));
+
+    // An empty network round-trips too
+    BusManager empty;
+    empty.SaveSnapshot(path);
+    loaded.LoadSnapshot(path);
+    string out;
+    loaded.RenderAllBuses(out);
+    assert(out == "No buses\n"s);
+
+    // A cut file is rejected and leaves the network as it was
+    bm.SaveSnapshot(path);
+    const auto size = filesystem::file_size(path);
+    filesystem::resize_file(path, size - 1);
+    bool thrown = false;
+    try {
+        loaded.LoadSnapshot(path);
+    } catch (const invalid_argument&) {
+        thrown = true;
+    }
+    assert(thrown);
+    out.clear();
+    loaded.RenderAllBuses(out);
+    assert(out == "No buses\n"s);
+    filesystem::remove(path);
+
+    cout << "TestSnapshot is OK"s << endl;
+}
+
 void TestBusManager() {
     TestGetAllBuses();
     TestGetStopsForBus();
     TestGetBusesForStop();
+    TestManyBuses();
+    TestJourney();
+    TestResponseCache();
+    TestQueryScanner();
+    TestConcurrentQueries();
+    TestSnapshot();
+}
+
+// Builds an input of query_count queries over a city-sized network:
+// one in fifty adds a route, the rest are read queries
+string MakeBenchmarkInput(int query_count) {
+    const int stop_count = 50000;
+    const int bus_count = 10000;
+    mt19937 generator(42);
+    ostringstream input;
+    input << query_count << "\n"s;
+    for (int i = 0; i < query_count; ++i) {
+        const int kind = generator() % 50;
+        if (kind < 1) {
+            const int route_size = 5 + generator() % 20;
+            input << "NEW_BUS bus"s << generator() % bus_count << " "s << route_size;
+            for (int j = 0; j < route_size; ++j) {
+                input << " stop"s << generator() % stop_count;
+            }
+        }
+        else if (kind < 25) {
+            input << "BUSES_FOR_STOP stop"s << generator() % stop_count;
+        }
+        else {
+            input << "STOPS_FOR_BUS bus"s << generator() % bus_count;
+        }
+        input << "\n"s;
+    }
+    return input.str();
+}
+
+// Compares the query loop reading with istream and printing response
+// vectors with endl against scanning the input in place and rendering
+// into one buffer written in batches, on one and on all threads
+void BenchmarkQueryLoop(int query_count) {
+    const string input = MakeBenchmarkInput(query_count);
+    ofstream null_output("/dev/null"s);
+
+    {
+        istringstream in(input);
+        const auto start = chrono::steady_clock::now();
+        int count;
+        in >> count;
+        BusManager bm;
+        for (int i = 0; i < count; ++i) {
+            Query q;
+            in >> q;
+            switch (q.type) {
+                case QueryType::NewBus:
+                    bm.AddBus(q.bus, q.stops);
+                    null_output << endl;
+                    break;
+                case QueryType::BusesForStop:
+                    null_output << bm.GetBusesForStop(q.stop) << endl;
+                    break;
+                case QueryType::StopsForBus:
+                    null_output << bm.GetStopsForBus(q.bus) << endl;
+                    break;
+                case QueryType::AllBuses:
+                    null_output << bm.GetAllBuses() << endl;
+                    break;
+                case QueryType::Journey:
+                    null_output << bm.GetJourney(q.stop, q.destination) << endl;
+                    break;
+            }
+        }
+        const auto duration = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start);
+        cout << "Responses with endl: "s << duration.count() << " ms, "s
+             << count * 1000LL / max<long long>(duration.count(), 1) << " queries/s"s << endl;
+    }
+
+    for (const int thread_count: {1, static_cast<int>(max(thread::hardware_concurrency(), 2u))}) {
+        const auto start = chrono::steady_clock::now();
+        BusManager bm;
+        ProcessQueries(input, bm, null_output, thread_count);
+        const auto duration = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start);
+        cout << "Scanned queries, rendered responses, "s << thread_count << " threads: "s << duration.count() << " ms, "s
+             << query_count * 1000LL / max<long long>(duration.count(), 1) << " queries/s"s << endl;
+    }
+}
+
+// Startup time of a network of bus_count routes: replaying NEW_BUS
+// queries against loading a snapshot of the result
+void BenchmarkSnapshot(int bus_count) {
+    mt19937 generator(42);
+    ostringstream input;
+    input << bus_count << "\n"s;
+    for (int i = 0; i < bus_count; ++i) {
+        const int route_size = 5 + generator() % 20;
+        input << "NEW_BUS bus"s << i << " "s << route_size;
+        for (int j = 0; j < route_size; ++j) {
+            input << " stop"s << generator() % (bus_count * 5);
+        }
+        input << "\n"s;
+    }
+    const string path = (filesystem::temp_directory_path() / "bus-snapshot-benchmark.bin").string();
+    ofstream null_output("/dev/null"s);
+
+    {
+        const auto start = chrono::steady_clock::now();
+        BusManager bm;
+        ProcessQueries(input.str(), bm, null_output, 1);
+        const auto duration = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start);
+        cout << "Replayed "s << bus_count << " NEW_BUS queries: "s << duration.count() << " ms"s << endl;
+        bm.SaveSnapshot(path);
+    }
+    {
+        const auto start = chrono::steady_clock::now();
+        BusManager bm;
+        bm.LoadSnapshot(path);
+        const auto duration = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start);
+        cout << "Loaded snapshot of "s << filesystem::file_size(path) << " bytes: "s << duration.count() << " ms"s << endl;
+    }
+    filesystem::remove(path);
+}
+
+// Average latency of JOURNEY queries between random stops of a
+// city-sized network
+void BenchmarkJourneys(int query_count) {
+    const int stop_count = 50000;
+    const int bus_count = 10000;
+    mt19937 generator(42);
+    BusManager bm;
+    for (int i = 0; i < bus_count; ++i) {
+        vector<string> stops(5 + generator() % 20);
+        for (string& stop: stops) {
+            stop = "stop"s + to_string(generator() % stop_count);
+        }
+        bm.AddBus("bus"s + to_string(i), stops);
+    }
+
+    vector<pair<string, string>> journeys;
+    for (int i = 0; i < query_count; ++i) {
+        journeys.push_back({"stop"s + to_string(generator() % stop_count), "stop"s + to_string(generator() % stop_count)});
+    }
+    string output;
+    const auto start = chrono::steady_clock::now();
+    for (const auto& [from, to]: journeys) {
+        bm.RenderJourney(from, to, output);
+        output.clear();
+    }
+    const auto duration = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start);
+    cout << "Journeys: "s << duration.count() / max(query_count, 1) << " us per query"s << endl;
 }
 
 // int main() {
 //     TestBusManager();
 // }
 
-int main() {
-    int query_count;
-    cin >> query_count;
-
+// Latency of single read queries once the buses of a generated input
+// of query_count queries are added
+void BenchmarkReadQueries(int query_count) {
     BusManager bm;
-    for (int i = 0; i < query_count; ++i) {
-        Query q;
-        cin >> q;
-        switch (q.type) {
-            case QueryType::NewBus:
-                bm.AddBus(q.bus, q.stops);
-                cout << endl;
-                break;
-            case QueryType::BusesForStop:
-                cout << bm.GetBusesForStop(q.stop) << endl;
-                break;
-            case QueryType::StopsForBus:
-                cout << bm.GetStopsForBus(q.bus) << endl;
-                break;
-            case QueryType::AllBuses:
-                cout << bm.GetAllBuses() << endl;
-                break;
+    ofstream null_output("/dev/null"s);
+    ProcessQueries(MakeBenchmarkInput(query_count), bm, null_output, 1);
+    BENCHMARK_ARGS(bm.GetBusesForStop, "stop123"s);
+    BENCHMARK_ARGS(bm.GetStopsForBus, "bus42"s);
+    BENCHMARK_ARGS(bm.GetJourney, "stop1"s, "stop2"s);
+}
+
+// int main() {
+//     BenchmarkQueryLoop(1'000'000);
+//     BenchmarkJourneys(10'000);
+//     BenchmarkSnapshot(300'000);
+//     BenchmarkReadQueries(1'000'000);
+// }
+
+// Usage: bus [--threads N] [--load-snapshot FILE] [--save-snapshot FILE]
+// < queries. The network starts from the loaded snapshot if one is given
+// and is saved after the queries are answered. Read queries are answered
+// on N threads, one by default
+int main(int argc, char* argv[]) {
+    int thread_count = 1;
+    string load_path;
+    string save_path;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        const string_view option = argv[i];
+        if (option == "--threads"sv) {
+            thread_count = max(atoi(argv[i + 1]), 1);
+        }
+        else if (option == "--load-snapshot"sv) {
+            load_path = argv[i + 1];
+        }
+        else if (option == "--save-snapshot"sv) {
+            save_path = argv[i + 1];
         }
     }
-}
\ No newline at end of file
+
+    BusManager bm;
+    if (!load_path.empty()) {
+        bm.LoadSnapshot(load_path);
+    }
+    const InputBuffer input;
+    ProcessQueries(input.GetView(), bm, cout, thread_count);
+    if (!save_path.empty()) {
+        bm.SaveSnapshot(save_path);
+    }
+}
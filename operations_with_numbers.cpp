@@ -1,174 +1,509 @@
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <execution>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+#include <vector>
 
 using namespace std;
 
+// Point or direction over any arithmetic scalar: float, double, integer
+// types or Rational. Everything is constexpr, so constants and tables of
+// vectors fold at compile time. The binary operators are friends rather
+// than templates so that the scalar converts, as in point * 2
+template <typename T>
 struct Vector2D {
-    Vector2D() = default;
+    constexpr Vector2D() = default;
 
-    Vector2D(double x0, double y0)
+    constexpr Vector2D(T x0, T y0)
         : x(x0)
         , y(y0) 
     {}
 
-    Vector2D& operator-=(Vector2D right) {
+    constexpr Vector2D& operator-=(Vector2D right) {
         x -= right.x;
         y -= right.y;
         return *this;
     }
 
-    Vector2D& operator+=(Vector2D right) {
+    constexpr Vector2D& operator+=(Vector2D right) {
         x += right.x;
         y += right.y;
         return *this;
     }
 
-    double x = 0.0;
-    double y = 0.0;
+    friend constexpr Vector2D operator*(Vector2D vector, T scalar) {
+        return {vector.x * scalar, vector.y * scalar};
+    }
+
+    friend constexpr Vector2D operator*(T scalar, Vector2D vector) {
+        return vector * scalar;
+    }
+
+    friend constexpr Vector2D operator-(Vector2D v) {
+        return Vector2D{-v.x, -v.y};
+    }
+
+    friend constexpr Vector2D operator-(Vector2D v1, Vector2D v2) {
+        return v1 -= v2;
+    }
+
+    friend constexpr Vector2D operator+(Vector2D v1, Vector2D v2) {
+        return v1 += v2;
+    }
+
+    friend constexpr bool operator==(Vector2D v1, Vector2D v2) {
+        return v1.x == v2.x && v1.y == v2.y;
+    }
+
+    friend constexpr bool operator!=(Vector2D v1, Vector2D v2) {
+        return !(v1 == v2);
+    }
+
+    T x = T();
+    T y = T();
 };
 
-Vector2D operator*(Vector2D vector, double scalar) {
-    return {vector.x * scalar, vector.y * scalar};
-}
+// Two doubles handled as one value, the width of the SSE2 and NEON
+// registers every 64-bit target has. GCC and Clang lower operations on
+// it to single SIMD instructions; wider vectors would be split into
+// scalars on targets without AVX
+using DoubleLanes = double __attribute__((vector_size(2 * sizeof(double))));
+const size_t LANE_COUNT = 2;
 
-Vector2D operator*(double scalar, Vector2D vector) {
-    return vector * scalar;
+DoubleLanes LoadLanes(const double* data) {
+    DoubleLanes lanes;
+    memcpy(&lanes, data, sizeof(lanes));
+    return lanes;
 }
 
-Vector2D operator-(Vector2D v) {
-    return Vector2D{-v.x, -v.y};
+void StoreLanes(double* data, DoubleLanes lanes) {
+    memcpy(data, &lanes, sizeof(lanes));
 }
 
-Vector2D operator-(Vector2D v1, Vector2D v2) {
-    return v1 -= v2;
+DoubleLanes MinLanes(DoubleLanes left, DoubleLanes right) {
+    return left < right ? left : right;
 }
 
-Vector2D operator+(Vector2D v1, Vector2D v2) {
-    return v1 += v2;
+DoubleLanes MaxLanes(DoubleLanes left, DoubleLanes right) {
+    return left > right ? left : right;
 }
 
+// Points stored as structure of arrays: all x, then all y. Bulk kernels
+// run two registers of LANE_COUNT points per step, so that independent
+// operations overlap, and finish the tail one by one
+class Vector2DArray {
+public:
+    // Reads and writes one point in place
+    class Reference {
+    public:
+        Reference(double& x, double& y)
+            : x_(x)
+            , y_(y)
+        {}
+
+        operator Vector2D<double>() const {
+            return {x_, y_};
+        }
+
+        Reference& operator=(Vector2D<double> v) {
+            x_ = v.x;
+            y_ = v.y;
+            return *this;
+        }
+
+    private:
+        double& x_;
+        double& y_;
+    };
+
+    Vector2DArray() = default;
+
+    explicit Vector2DArray(size_t size)
+        : xs_(size)
+        , ys_(size)
+    {}
+
+    explicit Vector2DArray(const vector<Vector2D<double>>& points) {
+        xs_.reserve(points.size());
+        ys_.reserve(points.size());
+        for (const Vector2D<double>& point : points) {
+            PushBack(point);
+        }
+    }
+
+    vector<Vector2D<double>> ToVector() const {
+        vector<Vector2D<double>> points;
+        points.reserve(Size());
+        for (size_t i = 0; i < Size(); ++i) {
+            points.push_back((*this)[i]);
+        }
+        return points;
+    }
+
+    size_t Size() const {
+        return xs_.size();
+    }
+
+    void PushBack(Vector2D<double> point) {
+        xs_.push_back(point.x);
+        ys_.push_back(point.y);
+    }
+
+    Vector2D<double> operator[](size_t index) const {
+        return {xs_[index], ys_[index]};
+    }
+
+    Reference operator[](size_t index) {
+        return {xs_[index], ys_[index]};
+    }
+
+    const double* Xs() const {
+        return xs_.data();
+    }
+
+    const double* Ys() const {
+        return ys_.data();
+    }
+
+    // this[i] += factor * other[i]
+    Vector2DArray& Axpy(double factor, const Vector2DArray& other) {
+        return Update(factor, &other, 1.0, {0.0, 0.0});
+    }
+
+    Vector2DArray& Scale(double factor) {
+        return Update(0.0, nullptr, factor, {0.0, 0.0});
+    }
+
+    Vector2DArray& Translate(Vector2D<double> offset) {
+        return Update(0.0, nullptr, 1.0, offset);
+    }
+
+    // this[i] = this[i] * factor + offset
+    Vector2DArray& Affine(double factor, Vector2D<double> offset) {
+        return Update(0.0, nullptr, factor, offset);
+    }
+
+    // this[i] = (this[i] + step * other[i]) * factor + offset in one pass
+    // over memory, the whole update of a simulation step
+    Vector2DArray& AxpyAffine(double step, const Vector2DArray& other, double factor, Vector2D<double> offset) {
+        return Update(step, &other, factor, offset);
+    }
+
+    // Sum of the dot products of matching points. Lanes are summed
+    // separately, so the rounding differs from a left-to-right loop
+    double Dot(const Vector2DArray& other) const {
+        assert(other.Size() == Size());
+        DoubleLanes sums[2] = {};
+        size_t i = 0;
+        for (; i + 2 * LANE_COUNT <= Size(); i += 2 * LANE_COUNT) {
+            for (size_t half = 0; half < 2; ++half) {
+                const size_t j = i + half * LANE_COUNT;
+                sums[half] += LoadLanes(xs_.data() + j) * LoadLanes(other.xs_.data() + j)
+                              + LoadLanes(ys_.data() + j) * LoadLanes(other.ys_.data() + j);
+            }
+        }
+        const DoubleLanes total = sums[0] + sums[1];
+        double dot = total[0] + total[1];
+        for (; i < Size(); ++i) {
+            dot += xs_[i] * other.xs_[i] + ys_[i] * other.ys_[i];
+        }
+        return dot;
+    }
+
+    // Length of every point, in lengths[i]
+    void Norms(vector<double>& lengths) const {
+        lengths.resize(Size());
+        size_t i = 0;
+        for (; i + LANE_COUNT <= Size(); i += LANE_COUNT) {
+            const DoubleLanes xs = LoadLanes(xs_.data() + i);
+            const DoubleLanes ys = LoadLanes(ys_.data() + i);
+            StoreLanes(lengths.data() + i, xs * xs + ys * ys);
+        }
+        for (; i < Size(); ++i) {
+            lengths[i] = xs_[i] * xs_[i] + ys_[i] * ys_[i];
+        }
+        for (double& length : lengths) {
+            length = sqrt(length);
+        }
+    }
+
+    double MaxNorm() const {
+        DoubleLanes maximums[2] = {};
+        size_t i = 0;
+        for (; i + 2 * LANE_COUNT <= Size(); i += 2 * LANE_COUNT) {
+            for (size_t half = 0; half < 2; ++half) {
+                const DoubleLanes xs = LoadLanes(xs_.data() + i + half * LANE_COUNT);
+                const DoubleLanes ys = LoadLanes(ys_.data() + i + half * LANE_COUNT);
+                maximums[half] = MaxLanes(maximums[half], xs * xs + ys * ys);
+            }
+        }
+        const DoubleLanes maximum_lanes = MaxLanes(maximums[0], maximums[1]);
+        double maximum = max(maximum_lanes[0], maximum_lanes[1]);
+        for (; i < Size(); ++i) {
+            maximum = max(maximum, xs_[i] * xs_[i] + ys_[i] * ys_[i]);
+        }
+        return sqrt(maximum);
+    }
+
+    // Lowest and highest corners of the box around all points. An empty
+    // array gives an inverted box from +infinity to -infinity
+    pair<Vector2D<double>, Vector2D<double>> BoundingBox() const {
+        const double infinity = numeric_limits<double>::infinity();
+        Vector2D<double> lowest{infinity, infinity};
+        Vector2D<double> highest{-infinity, -infinity};
+        for (auto [source, low, high] : {tuple{xs_.data(), &lowest.x, &highest.x}, tuple{ys_.data(), &lowest.y, &highest.y}}) {
+            DoubleLanes lows[2] = {{infinity, infinity}, {infinity, infinity}};
+            DoubleLanes highs[2] = {-lows[0], -lows[1]};
+            size_t i = 0;
+            for (; i + 2 * LANE_COUNT <= Size(); i += 2 * LANE_COUNT) {
+                for (size_t half = 0; half < 2; ++half) {
+                    const DoubleLanes values = LoadLanes(source + i + half * LANE_COUNT);
+                    lows[half] = MinLanes(lows[half], values);
+                    highs[half] = MaxLanes(highs[half], values);
+                }
+            }
+            const DoubleLanes low_lanes = MinLanes(lows[0], lows[1]);
+            const DoubleLanes high_lanes = MaxLanes(highs[0], highs[1]);
+            *low = min(low_lanes[0], low_lanes[1]);
+            *high = max(high_lanes[0], high_lanes[1]);
+            for (; i < Size(); ++i) {
+                *low = min(*low, source[i]);
+                *high = max(*high, source[i]);
+            }
+        }
+        return {lowest, highest};
+    }
+
+private:
+    vector<double> xs_;
+    vector<double> ys_;
+
+    // The kernel behind the update methods; other is null when there is
+    // nothing to add
+    Vector2DArray& Update(double step, const Vector2DArray* other, double factor, Vector2D<double> offset) {
+        assert(other == nullptr || other->Size() == Size());
+        const DoubleLanes steps = {step, step};
+        const DoubleLanes factors = {factor, factor};
+        for (int axis = 0; axis < 2; ++axis) {
+            double* target = axis == 0 ? xs_.data() : ys_.data();
+            const double* source = other == nullptr ? nullptr : axis == 0 ? other->xs_.data() : other->ys_.data();
+            const double shift = axis == 0 ? offset.x : offset.y;
+            const DoubleLanes shifts = {shift, shift};
+            size_t i = 0;
+            if (source != nullptr) {
+                for (; i + 2 * LANE_COUNT <= Size(); i += 2 * LANE_COUNT) {
+                    for (size_t half = 0; half < 2; ++half) {
+                        const size_t j = i + half * LANE_COUNT;
+                        StoreLanes(target + j, (LoadLanes(target + j) + steps * LoadLanes(source + j)) * factors + shifts);
+                    }
+                }
+                for (; i < Size(); ++i) {
+                    target[i] = (target[i] + step * source[i]) * factor + shift;
+                }
+            }
+            else {
+                for (; i + 2 * LANE_COUNT <= Size(); i += 2 * LANE_COUNT) {
+                    for (size_t half = 0; half < 2; ++half) {
+                        const size_t j = i + half * LANE_COUNT;
+                        StoreLanes(target + j, LoadLanes(target + j) * factors + shifts);
+                    }
+                }
+                for (; i < Size(); ++i) {
+                    target[i] = target[i] * factor + shift;
+                }
+            }
+        }
+        return *this;
+    }
+};
+
+// Exact fraction kept in lowest terms with a positive denominator.
+// Intermediate products are computed in 128 bits, and a result that
+// does not fit int64_t (or is INT64_MIN, whose negation would not fit)
+// throws overflow_error instead of wrapping around. Everything but
+// output is constexpr; a throw in a constant expression fails to compile
 class Rational {
 public:
-    Rational() = default;
+    constexpr Rational() = default;
 
-    Rational(int numerator)
-        : numerator_(numerator)
+    constexpr Rational(int64_t numerator)
+        : numerator_(Narrow(numerator))
         , denominator_(1) {
     }
 
-    Rational(int numerator, int denominator)
-        : numerator_(numerator)
-        , denominator_(denominator) {
-        Normalize();
+    constexpr Rational(int64_t numerator, int64_t denominator) {
+        if (denominator == 0) {
+            throw domain_error("zero denominator"s);
+        }
+        __int128 wide_numerator = numerator;
+        __int128 wide_denominator = denominator;
+        if (wide_denominator < 0) {
+            wide_numerator = -wide_numerator;
+            wide_denominator = -wide_denominator;
+        }
+        const uint64_t divisor = gcd(Magnitude(wide_numerator), static_cast<uint64_t>(wide_denominator));
+        numerator_ = Narrow(wide_numerator / divisor);
+        denominator_ = Narrow(wide_denominator / divisor);
     }
 
-    int Numerator() const {
+    constexpr int64_t Numerator() const {
         return numerator_;
     }
 
-    int Denominator() const {
+    constexpr int64_t Denominator() const {
         return denominator_;
     }
 
-    int gcd(int a, int b) {
-        a = abs(a);
-        b = abs(b);
-        while (a != b) {
-            a > b
-            ? a -= b
-            : b -= a;
+    // Binary GCD: shifts and subtractions only, O(log(max(a, b))) steps.
+    // gcd(a, 0) is a. std::swap is not constexpr before C++20
+    static constexpr uint64_t gcd(uint64_t a, uint64_t b) {
+        if (a == 0 || b == 0) {
+            return a | b;
         }
-        return a;
+        const int shift = __builtin_ctzll(a | b);
+        a >>= __builtin_ctzll(a);
+        while (b != 0) {
+            b >>= __builtin_ctzll(b);
+            if (a > b) {
+                const uint64_t larger = a;
+                a = b;
+                b = larger;
+            }
+            b -= a;
+        }
+        return a << shift;
     }
 
-    Rational& operator-=(Rational right) {
-        numerator_ =  numerator_ * right.denominator_ - right.numerator_ * denominator_;
-        denominator_ *= right.denominator_;
-        Normalize();
-        return *this;
+    constexpr Rational& operator-=(Rational right) {
+        right.numerator_ = -right.numerator_;
+        return *this += right;
     }
 
-    Rational& operator+=(Rational right) {
-        numerator_ =  numerator_ * right.denominator_ + right.numerator_ * denominator_;
-        denominator_ *= right.denominator_;
-        Normalize();
+    // The denominators are divided by their gcd before multiplying, and
+    // the sum can then only share factors with that gcd, so the result
+    // is reduced without a gcd of the full products
+    constexpr Rational& operator+=(Rational right) {
+        const uint64_t divisor = gcd(denominator_, right.denominator_);
+        const int64_t left_factor = right.denominator_ / divisor;
+        const int64_t right_factor = denominator_ / divisor;
+        const __int128 numerator = static_cast<__int128>(numerator_) * left_factor
+                                   + static_cast<__int128>(right.numerator_) * right_factor;
+        const __int128 denominator = static_cast<__int128>(denominator_) * left_factor;
+        // The sum may not fit 64 bits, so it is taken modulo divisor first
+        const uint64_t common = gcd(static_cast<uint64_t>((numerator < 0 ? -numerator : numerator) % divisor), divisor);
+        numerator_ = Narrow(numerator / common);
+        denominator_ = Narrow(denominator / common);
         return *this;
     }
 
-    Rational& operator*=(Rational right) {
-        numerator_ *= right.numerator_;
-        denominator_ *= right.denominator_;
-        Normalize();
+    // Each numerator is cancelled against the other denominator first,
+    // which keeps the product reduced and as small as it can be
+    constexpr Rational& operator*=(Rational right) {
+        const uint64_t left_divisor = gcd(Magnitude(numerator_), right.denominator_);
+        const uint64_t right_divisor = gcd(Magnitude(right.numerator_), denominator_);
+        numerator_ = Narrow(static_cast<__int128>(numerator_ / static_cast<int64_t>(left_divisor))
+                            * (right.numerator_ / static_cast<int64_t>(right_divisor)));
+        denominator_ = Narrow(static_cast<__int128>(denominator_ / static_cast<int64_t>(right_divisor))
+                              * (right.denominator_ / static_cast<int64_t>(left_divisor)));
         return *this;
     }
 
-    Rational& operator/=(Rational right) {
-        numerator_ *= right.denominator_;
-        denominator_ *= right.numerator_;
-        Normalize();
-        return *this;
+    constexpr Rational& operator/=(Rational right) {
+        if (right.numerator_ == 0) {
+            throw domain_error("division by zero"s);
+        }
+        if (right.numerator_ < 0) {
+            right.numerator_ = -right.numerator_;
+            right.denominator_ = -right.denominator_;
+        }
+        return *this *= Rational::FromReduced(right.denominator_, right.numerator_);
     }
 
 private:
-    void Normalize() {
-        if (denominator_ < 0) {
-            numerator_ = -numerator_;
-            denominator_ = -denominator_;
+    // Skips the gcd for parts that are already coprime, with a positive
+    // denominator; the reciprocal of a reduced fraction is one
+    static constexpr Rational FromReduced(int64_t numerator, int64_t denominator) {
+        Rational rational;
+        rational.numerator_ = numerator;
+        rational.denominator_ = denominator;
+        return rational;
+    }
+
+    static constexpr uint64_t Magnitude(__int128 value) {
+        return static_cast<uint64_t>(value < 0 ? -value : value);
+    }
+
+    static constexpr int64_t Narrow(__int128 value) {
+        if (value > numeric_limits<int64_t>::max() || value < -numeric_limits<int64_t>::max()) {
+            throw overflow_error("rational out of int64 range"s);
         }
-        const int divisor = gcd(numerator_, denominator_);
-        numerator_ /= divisor;
-        denominator_ /= divisor;
+        return static_cast<int64_t>(value);
     }
 
-    int numerator_ = 0;
-    int denominator_ = 1;
+    int64_t numerator_ = 0;
+    int64_t denominator_ = 1;
 };
 
-Rational operator+(Rational left, Rational right) {
+constexpr Rational operator+(Rational left, Rational right) {
     return left += right;
 }
 
-Rational operator+(Rational r) {
+constexpr Rational operator+(Rational r) {
     return r;
 }
 
-Rational operator-(Rational left, Rational right) {
+constexpr Rational operator-(Rational left, Rational right) {
     return left -= right;
 }
 
-Rational operator-(Rational r) {
+constexpr Rational operator-(Rational r) {
     return Rational{-r.Numerator(), r.Denominator()};
 }
 
-Rational operator*(Rational left, Rational right) {
+constexpr Rational operator*(Rational left, Rational right) {
     return left *= right;
 }
 
-Rational operator/(Rational left, Rational right) {
+constexpr Rational operator/(Rational left, Rational right) {
     return left /= right;
 }
 
-bool operator==(Rational left, Rational right) {
+constexpr bool operator==(Rational left, Rational right) {
     return left.Numerator() == right.Numerator() &&
            left.Denominator() == right.Denominator();
 }
 
-bool operator!=(Rational left, Rational right) {
+constexpr bool operator!=(Rational left, Rational right) {
     return !(left == right);
 }
 
-bool operator<(Rational left, Rational right) {
-    return left.Numerator() * right.Denominator() < right.Numerator() * left.Denominator();
+// Cross products of two int64_t values always fit in 128 bits
+constexpr bool operator<(Rational left, Rational right) {
+    return static_cast<__int128>(left.Numerator()) * right.Denominator()
+           < static_cast<__int128>(right.Numerator()) * left.Denominator();
 }
 
-bool operator>(Rational left, Rational right) {
-    return left.Numerator() * right.Denominator() > right.Numerator() * left.Denominator();
+constexpr bool operator>(Rational left, Rational right) {
+    return right < left;
 }
 
-bool operator<=(Rational left, Rational right) {
+constexpr bool operator<=(Rational left, Rational right) {
     return !(left > right);
 }
 
-bool operator>=(Rational left, Rational right) {
+constexpr bool operator>=(Rational left, Rational right) {
     return !(left < right);
 }
 
@@ -177,11 +512,659 @@ ostream& operator<<(ostream& out, const Rational& rational) {
     return out;
 }
 
-ostream& operator<<(ostream& out, const Vector2D v) {
+// Ranges are reduced in chunks of this many values, in parallel when
+// there is more than one. A chunk adds numerators per denominator for at
+// most MAX_DENOMINATOR_GROUPS distinct denominators at a time
+const size_t REDUCE_CHUNK_SIZE = 1 << 14;
+const size_t MAX_DENOMINATOR_GROUPS = 16;
+
+// Partial sum of a reduction: a 128-bit numerator over the least common
+// multiple of the denominators added so far, reduced only when it would
+// not fit otherwise. Overflow is carried as a flag, because an exception
+// must not leave a parallel algorithm
+struct RationalSum {
+    __int128 numerator = 0;
+    int64_t denominator = 1;
+    bool overflow = false;
+
+    void Reduce() {
+        const uint64_t magnitude = static_cast<uint64_t>((numerator < 0 ? -numerator : numerator) % denominator);
+        const int64_t divisor = Rational::gcd(magnitude, denominator);
+        numerator /= divisor;
+        denominator /= divisor;
+    }
+};
+
+// Sets product and returns false unless it overflows. The generic
+// 128-bit overflow check is a library call, so a numerator that fits
+// int64_t takes the plain multiplication, which cannot overflow
+bool MultiplyOverflows(__int128 numerator, int64_t factor, __int128& product) {
+    if (static_cast<int64_t>(numerator) == numerator) {
+        product = static_cast<__int128>(static_cast<int64_t>(numerator)) * factor;
+        return false;
+    }
+    return __builtin_mul_overflow(numerator, static_cast<__int128>(factor), &product);
+}
+
+// Scales both sums to the common denominator and adds the numerators;
+// if that overflows, retries once with both sums reduced
+RationalSum AddSums(RationalSum left, RationalSum right) {
+    if (left.overflow || right.overflow) {
+        return {0, 1, true};
+    }
+    // Most values of a batch divide the common denominator already
+    if (left.denominator < right.denominator) {
+        swap(left, right);
+    }
+    if (left.denominator % right.denominator == 0) {
+        __int128 right_part;
+        if (!MultiplyOverflows(right.numerator, left.denominator / right.denominator, right_part)
+            && !__builtin_add_overflow(left.numerator, right_part, &left.numerator)) {
+            return left;
+        }
+    }
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        if (attempt == 1) {
+            left.Reduce();
+            right.Reduce();
+        }
+        const int64_t divisor = Rational::gcd(left.denominator, right.denominator);
+        int64_t denominator;
+        __int128 left_part;
+        __int128 right_part;
+        RationalSum sum;
+        if (!__builtin_mul_overflow(left.denominator / divisor, right.denominator, &denominator)
+            && !MultiplyOverflows(left.numerator, right.denominator / divisor, left_part)
+            && !MultiplyOverflows(right.numerator, left.denominator / divisor, right_part)
+            && !__builtin_add_overflow(left_part, right_part, &sum.numerator)) {
+            sum.denominator = denominator;
+            return sum;
+        }
+    }
+    return {0, 1, true};
+}
+
+// Values of one denominator are summed without any division; only the
+// few group totals are scaled to a common denominator. A group adds at
+// most REDUCE_CHUNK_SIZE int64_t numerators, which cannot overflow 128 bits
+template <typename Iterator>
+RationalSum SumChunk(Iterator first, Iterator last) {
+    RationalSum sum;
+    vector<pair<int64_t, __int128>> groups;
+    const auto fold_groups = [&sum, &groups] {
+        for (const auto& [denominator, numerator] : groups) {
+            sum = AddSums(sum, {numerator, denominator, false});
+        }
+        groups.clear();
+    };
+    for (; first != last; ++first) {
+        const Rational value = *first;
+        auto group = find_if(groups.begin(), groups.end(), [&value](const pair<int64_t, __int128>& group) {
+            return group.first == value.Denominator();
+        });
+        if (group == groups.end()) {
+            if (groups.size() == MAX_DENOMINATOR_GROUPS) {
+                fold_groups();
+            }
+            groups.push_back({value.Denominator(), 0});
+            group = prev(groups.end());
+        }
+        group->second += value.Numerator();
+    }
+    fold_groups();
+    return sum;
+}
+
+// Exact sum of [first, last). Throws overflow_error if the sum, or a
+// partial sum even after reduction, does not fit
+template <typename Iterator>
+Rational Sum(Iterator first, Iterator last) {
+    const size_t size = distance(first, last);
+    const size_t chunk_count = max<size_t>(1, (size + REDUCE_CHUNK_SIZE - 1) / REDUCE_CHUNK_SIZE);
+    vector<RationalSum> chunk_sums(chunk_count);
+    if (chunk_count == 1) {
+        chunk_sums[0] = SumChunk(first, last);
+    } else {
+        vector<size_t> chunks(chunk_count);
+        iota(chunks.begin(), chunks.end(), 0);
+        for_each(execution::par, chunks.begin(), chunks.end(), [&](size_t chunk) {
+            const size_t begin = chunk * REDUCE_CHUNK_SIZE;
+            const size_t end = min(size, begin + REDUCE_CHUNK_SIZE);
+            chunk_sums[chunk] = SumChunk(next(first, begin), next(first, end));
+        });
+    }
+
+    RationalSum sum = accumulate(chunk_sums.begin(), chunk_sums.end(), RationalSum{}, AddSums);
+    if (sum.overflow) {
+        throw overflow_error("sum out of int64 range"s);
+    }
+    sum.Reduce();
+    if (sum.numerator > numeric_limits<int64_t>::max() || sum.numerator < -numeric_limits<int64_t>::max()) {
+        throw overflow_error("sum out of int64 range"s);
+    }
+    return Rational(static_cast<int64_t>(sum.numerator), sum.denominator);
+}
+
+// Euclid while either value needs more than 64 bits, then the binary gcd
+unsigned __int128 WideGcd(unsigned __int128 a, unsigned __int128 b) {
+    while (b != 0 && (a >> 64 != 0 || b >> 64 != 0)) {
+        const unsigned __int128 remainder = a % b;
+        a = b;
+        b = remainder;
+    }
+    return b == 0 ? a : Rational::gcd(static_cast<uint64_t>(a), static_cast<uint64_t>(b));
+}
+
+// Partial product of a reduction: a reduced fraction of 128-bit parts, so
+// factors that cancel later may outgrow int64_t in between. Overflow is
+// carried as in RationalSum
+struct RationalProduct {
+    __int128 numerator = 1;
+    __int128 denominator = 1;
+    bool overflow = false;
+};
+
+// Cancels each numerator against the other denominator first, as
+// Rational::operator*= does, which keeps the product reduced
+RationalProduct MultiplyProducts(RationalProduct left, const RationalProduct& right) {
+    if (left.overflow || right.overflow) {
+        return {0, 1, true};
+    }
+    const auto magnitude = [](__int128 value) {
+        return value < 0 ? -static_cast<unsigned __int128>(value) : static_cast<unsigned __int128>(value);
+    };
+    const __int128 left_divisor = WideGcd(magnitude(left.numerator), right.denominator);
+    const __int128 right_divisor = WideGcd(magnitude(right.numerator), left.denominator);
+    if (__builtin_mul_overflow(left.numerator / left_divisor, right.numerator / right_divisor, &left.numerator)
+        || __builtin_mul_overflow(left.denominator / right_divisor, right.denominator / left_divisor, &left.denominator)) {
+        return {0, 1, true};
+    }
+    return left;
+}
+
+// Exact product of [first, last). Throws overflow_error if the product
+// does not fit, or if a partial product in the grouping the reduction
+// picks does not fit 128 bits even after cancellation
+template <typename Iterator>
+Rational Product(Iterator first, Iterator last) {
+    const auto to_product = [](Rational value) {
+        return RationalProduct{value.Numerator(), value.Denominator(), false};
+    };
+    const RationalProduct product = static_cast<size_t>(distance(first, last)) <= REDUCE_CHUNK_SIZE
+        ? transform_reduce(execution::seq, first, last, RationalProduct{}, MultiplyProducts, to_product)
+        : transform_reduce(execution::par, first, last, RationalProduct{}, MultiplyProducts, to_product);
+    if (product.overflow
+        || product.numerator > numeric_limits<int64_t>::max() || product.numerator < -numeric_limits<int64_t>::max()
+        || product.denominator > numeric_limits<int64_t>::max()) {
+        throw overflow_error("product out of int64 range"s);
+    }
+    return Rational(static_cast<int64_t>(product.numerator), static_cast<int64_t>(product.denominator));
+}
+
+// Throws domain_error for an empty range
+template <typename Iterator>
+Rational Mean(Iterator first, Iterator last) {
+    const int64_t count = distance(first, last);
+    if (count == 0) {
+        throw domain_error("mean of no values"s);
+    }
+    return Sum(first, last) / Rational(count);
+}
+
+template <typename T>
+ostream& operator<<(ostream& out, const Vector2D<T> v) {
     out << "{"s << v.x << ", "s << v.y << "}"s;
     return out;
 }
 
+void TestRational() {
+    // Zero numerators used to hang gcd
+    assert(Rational(0, 5) == Rational(0));
+    assert(Rational(0, -5).Denominator() == 1);
+    assert(Rational(1, 3) - Rational(1, 3) == Rational(0));
+    assert(Rational::gcd(0, 0) == 0 && Rational::gcd(12, 0) == 12 && Rational::gcd(48, 180) == 12);
+
+    const Rational half(-3, -6);
+    assert(half.Numerator() == 1 && half.Denominator() == 2);
+    assert(Rational(4, -6) == Rational(-2, 3));
+    assert(Rational(1, 6) + Rational(1, 3) == half);
+    assert(Rational(3, 4) * Rational(2, 9) == Rational(1, 6));
+    assert(Rational(3, 4) / Rational(-9, 2) == Rational(-1, 6));
+
+    // Large values compare and cancel without overflowing
+    const int64_t big = numeric_limits<int64_t>::max();
+    assert(Rational(big - 1, big) < Rational(big, big - 1));
+    assert(Rational(-big, 3) < Rational(big, 3));
+    assert(Rational(big, 2) * Rational(2, big) == Rational(1));
+    assert(Rational(1, big) + Rational(1, big) == Rational(2, big));
+
+    bool overflow_thrown = false;
+    try {
+        Rational(big) + Rational(1);
+    } catch (const overflow_error&) {
+        overflow_thrown = true;
+    }
+    assert(overflow_thrown);
+    overflow_thrown = false;
+    try {
+        Rational(numeric_limits<int64_t>::min());
+    } catch (const overflow_error&) {
+        overflow_thrown = true;
+    }
+    assert(overflow_thrown);
+
+    bool domain_thrown = false;
+    try {
+        Rational(1) / Rational(0);
+    } catch (const domain_error&) {
+        domain_thrown = true;
+    }
+    assert(domain_thrown);
+
+    // Results are reduced and equal the exact fraction
+    mt19937_64 generator(1);
+    for (int i = 0; i < 100000; ++i) {
+        const int64_t limit = i % 2 == 0 ? 1000 : 1'000'000'000;
+        const auto random_rational = [&] {
+            const int64_t numerator = static_cast<int64_t>(generator() % (2 * limit + 1)) - limit;
+            return Rational(numerator, 1 + static_cast<int64_t>(generator() % limit));
+        };
+        const Rational a = random_rational();
+        const Rational b = random_rational();
+        const auto check = [](Rational result, __int128 numerator, __int128 denominator) {
+            assert(result.Denominator() > 0);
+            assert(Rational::gcd(result.Numerator() < 0 ? -result.Numerator() : result.Numerator(), result.Denominator()) == 1
+                   || result.Numerator() == 0);
+            assert(static_cast<__int128>(result.Numerator()) * denominator == numerator * result.Denominator());
+        };
+        const __int128 an = a.Numerator(), ad = a.Denominator(), bn = b.Numerator(), bd = b.Denominator();
+        check(a + b, an * bd + bn * ad, ad * bd);
+        check(a - b, an * bd - bn * ad, ad * bd);
+        check(a * b, an * bn, ad * bd);
+        if (bn != 0) {
+            check(a / b, an * bd, ad * bn);
+        }
+        assert((a < b) == (an * bd < bn * ad));
+    }
+
+    // Sums of numerators near the int64 limit overflow 64 bits before
+    // they are reduced; they must still be exact, and throw only when
+    // the reduced result does not fit
+    assert(Rational(big, 6) + Rational(big, 3) == Rational(big, 2));
+    overflow_thrown = false;
+    try {
+        Rational(9079962125781124643, 6) + Rational(7668639407681340379, 3);
+    } catch (const overflow_error&) {
+        overflow_thrown = true;
+    }
+    assert(overflow_thrown);
+    const auto reduce = [](__int128 numerator, __int128 denominator) {
+        unsigned __int128 a = numerator < 0 ? -numerator : numerator;
+        unsigned __int128 b = denominator;
+        while (b != 0) {
+            a %= b;
+            swap(a, b);
+        }
+        return pair{numerator / static_cast<__int128>(a), denominator / static_cast<__int128>(a)};
+    };
+    for (int i = 0; i < 100000; ++i) {
+        const auto random_rational = [&generator] {
+            const int64_t numerator = static_cast<int64_t>(generator() >> 1) * (generator() % 2 == 0 ? 1 : -1);
+            return Rational(numerator, 1 + static_cast<int64_t>(generator() % 12));
+        };
+        const Rational a = random_rational();
+        const Rational b = random_rational();
+        const auto [numerator, denominator] = reduce(static_cast<__int128>(a.Numerator()) * b.Denominator()
+                                                     + static_cast<__int128>(b.Numerator()) * a.Denominator(),
+                                                     static_cast<__int128>(a.Denominator()) * b.Denominator());
+        const __int128 limit = numeric_limits<int64_t>::max();
+        if (numerator > limit || numerator < -limit || denominator > limit) {
+            overflow_thrown = false;
+            try {
+                a + b;
+            } catch (const overflow_error&) {
+                overflow_thrown = true;
+            }
+            assert(overflow_thrown);
+        } else {
+            const Rational sum = a + b;
+            assert(sum.Numerator() == numerator && sum.Denominator() == denominator);
+        }
+    }
+
+    cout << "TestRational is OK"s << endl;
+}
+
+void TestRationalReduction() {
+    const vector<Rational> empty;
+    assert(Sum(empty.begin(), empty.end()) == Rational(0));
+    assert(Product(empty.begin(), empty.end()) == Rational(1));
+    bool domain_thrown = false;
+    try {
+        Mean(empty.begin(), empty.end());
+    } catch (const domain_error&) {
+        domain_thrown = true;
+    }
+    assert(domain_thrown);
+
+    const vector<Rational> small = {Rational(1, 2), Rational(1, 3), Rational(1, 6), Rational(-5, 4)};
+    assert(Sum(small.begin(), small.end()) == Rational(-1, 4));
+    assert(Product(small.begin(), small.end()) == Rational(-5, 144));
+    assert(Mean(small.begin(), small.end()) == Rational(-1, 16));
+
+    // Large enough to run in parallel; (i + 1) / i telescopes to n + 1
+    const int count = 100'000;
+    vector<Rational> telescope;
+    mt19937 generator(7);
+    vector<Rational> prices;
+    for (int i = 1; i <= count; ++i) {
+        telescope.push_back(Rational(i + 1, i));
+        const int64_t denominators[] = {1, 2, 4, 5, 10, 20, 25, 50, 100, 3, 7};
+        prices.push_back(Rational(static_cast<int64_t>(generator() % 2'000'001) - 1'000'000, denominators[generator() % 11]));
+    }
+    assert(Product(telescope.begin(), telescope.end()) == Rational(count + 1));
+    Rational expected_sum;
+    for (const Rational& price : prices) {
+        expected_sum += price;
+    }
+    assert(Sum(prices.begin(), prices.end()) == expected_sum);
+    assert(Mean(prices.begin(), prices.end()) * Rational(count) == expected_sum);
+
+    // Partial sums that only fit once reduced are still exact
+    const int64_t big = numeric_limits<int64_t>::max();
+    const vector<Rational> reducible(count, Rational(1, big));
+    assert(Sum(reducible.begin(), reducible.end()) == Rational(count, big));
+
+    // Partial products past int64_t are fine when later factors cancel
+    // them, in sequence and in parallel
+    const Rational power = Rational(int64_t{1} << 40);
+    const vector<Rational> cancelling = {power, power, Rational(1, int64_t{1} << 40)};
+    assert(Product(cancelling.begin(), cancelling.end()) == power);
+    vector<Rational> parallel_cancelling(count, Rational(1));
+    parallel_cancelling.front() = power;
+    parallel_cancelling[count / 2] = -power;
+    parallel_cancelling.back() = Rational(1, int64_t{1} << 40);
+    assert(Product(parallel_cancelling.begin(), parallel_cancelling.end()) == -power);
+
+    for (const vector<Rational>& values : {vector<Rational>(count, Rational(big / 1000)), vector<Rational>(64, Rational(3))}) {
+        bool overflow_thrown = false;
+        try {
+            values.size() == 64 ? Product(values.begin(), values.end()) : Sum(values.begin(), values.end());
+        } catch (const overflow_error&) {
+            overflow_thrown = true;
+        }
+        assert(overflow_thrown);
+    }
+
+    cout << "TestRationalReduction is OK"s << endl;
+}
+
+// First N harmonic numbers 1, 1 + 1/2, ... as a table the compiler builds
+template <size_t N>
+constexpr array<Rational, N> HarmonicNumbers() {
+    array<Rational, N> numbers{};
+    Rational sum = 0;
+    for (size_t i = 0; i < N; ++i) {
+        sum += Rational(1, i + 1);
+        numbers[i] = sum;
+    }
+    return numbers;
+}
+
+void TestConstexpr() {
+    static_assert(Rational(-3, -6) == Rational(1, 2));
+    static_assert(Rational(1, 6) + Rational(1, 3) - Rational(1, 2) == Rational(0));
+    static_assert(Rational(3, 4) / Rational(-3, 8) == Rational(-2));
+    static_assert(Rational(2, 3) * Rational(9, 4) > Rational(1));
+    static_assert(Rational::gcd(48, 180) == 12);
+
+    constexpr auto harmonic = HarmonicNumbers<20>();
+    static_assert(harmonic[0] == Rational(1) && harmonic[9] == Rational(7381, 2520));
+    static_assert(harmonic[19] == Rational(55835135, 15519504));
+
+    static_assert(2 * Vector2D<int>{1, -2} + Vector2D<int>{0, 5} == Vector2D<int>{2, 1});
+    static_assert(-Vector2D<long long>{3, 4} - Vector2D<long long>{1, 1} == Vector2D<long long>{-4, -5});
+    constexpr Vector2D<Rational> midpoint = (Vector2D<Rational>{1, 2} + Vector2D<Rational>{Rational(1, 2), 0}) * Rational(1, 2);
+    static_assert(midpoint == Vector2D<Rational>{Rational(3, 4), 1});
+    static_assert(Vector2D{1.5f, 2.0f} * 2.0f == Vector2D{3.0f, 4.0f});
+    static_assert(Vector2D<double>{} == Vector2D{0.0, 0.0});
+
+    // The same code still throws when it runs
+    const Rational zero = harmonic[0] - 1;
+    try {
+        harmonic[1] / zero;
+        assert(false);
+    } catch (const domain_error&) {
+    }
+    cout << "TestConstexpr is OK"s << endl;
+}
+
+void TestVector2DArray() {
+    const vector<Vector2D<double>> points = {{1, 2}, {-3, 4}, {5, -6}, {0.5, 0}, {-7, 8}, {2, 2}};
+    Vector2DArray array(points);
+    assert(array.Size() == points.size());
+    const Vector2D<double> third = array[2];
+    assert(third.x == 5 && third.y == -6);
+    array[3] = Vector2D<double>{9, -9};
+    const Vector2D<double> fourth = array[3];
+    assert(fourth.x == 9 && fourth.y == -9);
+    array[3] = points[3];
+
+    // Every kernel matches the scalar operators, tail points included
+    vector<Vector2D<double>> expected = points;
+    const Vector2DArray velocities(vector<Vector2D<double>>(points.size(), {1, -1}));
+    array.Axpy(0.5, velocities).Scale(2).Translate({-1, 3}).Affine(3, {1, 1}).AxpyAffine(0.25, velocities, 0.5, {2, 0});
+    for (Vector2D<double>& point : expected) {
+        point = (point + 0.5 * Vector2D<double>{1, -1}) * 2 + Vector2D<double>{-1, 3};
+        point = point * 3 + Vector2D<double>{1, 1};
+        point = (point + 0.25 * Vector2D<double>{1, -1}) * 0.5 + Vector2D<double>{2, 0};
+    }
+    const vector<Vector2D<double>> result = array.ToVector();
+    for (size_t i = 0; i < points.size(); ++i) {
+        assert(result[i].x == expected[i].x && result[i].y == expected[i].y);
+    }
+
+    const Vector2DArray original(points);
+    assert(abs(original.Dot(original) - (1 + 4 + 9 + 16 + 25 + 36 + 0.25 + 49 + 64 + 4 + 4)) < 1e-9);
+    vector<double> lengths;
+    original.Norms(lengths);
+    assert(lengths.size() == points.size() && abs(lengths[1] - 5) < 1e-12);
+    assert(abs(original.MaxNorm() - sqrt(113.0)) < 1e-12);
+    const auto [lowest, highest] = original.BoundingBox();
+    assert(lowest.x == -7 && lowest.y == -6 && highest.x == 5 && highest.y == 8);
+
+    const auto [empty_lowest, empty_highest] = Vector2DArray().BoundingBox();
+    assert(empty_lowest.x > empty_highest.x);
+    assert(Vector2DArray().MaxNorm() == 0 && Vector2DArray().Dot(Vector2DArray()) == 0);
+
+    cout << "TestVector2DArray is OK"s << endl;
+}
+
+// The Rational arithmetic before the 64-bit core: int fields, gcd by
+// repeated subtraction and a full Normalize after every operation
+class LegacyRational {
+public:
+    LegacyRational(int numerator, int denominator)
+        : numerator_(numerator)
+        , denominator_(denominator) {
+        Normalize();
+    }
+
+    int Numerator() const {
+        return numerator_;
+    }
+
+    LegacyRational& operator+=(LegacyRational right) {
+        numerator_ =  numerator_ * right.denominator_ + right.numerator_ * denominator_;
+        denominator_ *= right.denominator_;
+        Normalize();
+        return *this;
+    }
+
+    LegacyRational& operator*=(LegacyRational right) {
+        numerator_ *= right.numerator_;
+        denominator_ *= right.denominator_;
+        Normalize();
+        return *this;
+    }
+
+    bool operator<(LegacyRational right) const {
+        return numerator_ * right.denominator_ < right.numerator_ * denominator_;
+    }
+
+private:
+    int numerator_;
+    int denominator_;
+
+    static int gcd(int a, int b) {
+        a = abs(a);
+        b = abs(b);
+        while (a != b) {
+            a > b
+            ? a -= b
+            : b -= a;
+        }
+        return a;
+    }
+
+    void Normalize() {
+        if (denominator_ < 0) {
+            numerator_ = -numerator_;
+            denominator_ = -denominator_;
+        }
+        const int divisor = gcd(numerator_, denominator_);
+        numerator_ /= divisor;
+        denominator_ /= divisor;
+    }
+};
+
+// Adds, multiplies and compares pairs of positive fractions whose
+// parts are below 1000, small enough for LegacyRational not to overflow
+template <typename Number>
+void BenchmarkArithmetic(const string& name, const vector<pair<int, int>>& parts) {
+    const auto start = chrono::steady_clock::now();
+    int64_t checksum = 0;
+    for (size_t i = 0; i + 1 < parts.size(); i += 2) {
+        const Number a(parts[i].first, parts[i].second);
+        const Number b(parts[i + 1].first, parts[i + 1].second);
+        Number sum = a;
+        sum += b;
+        Number product = a;
+        product *= b;
+        checksum += sum.Numerator() + product.Numerator() + (a < b);
+    }
+    const auto duration = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start);
+    cout << name << ": "s << duration.count() << " ms (checksum "s << checksum << ")"s << endl;
+}
+
+// Sums value_count amounts of money with the += loop and with Sum
+void BenchmarkRationalSum(int value_count) {
+    mt19937 generator(42);
+    vector<Rational> values;
+    values.reserve(value_count);
+    const int64_t denominators[] = {1, 2, 4, 5, 10, 20, 25, 50, 100};
+    for (int i = 0; i < value_count; ++i) {
+        values.push_back(Rational(generator() % 1'000'000, denominators[generator() % 9]));
+    }
+
+    auto start = chrono::steady_clock::now();
+    Rational loop_sum;
+    for (const Rational& value : values) {
+        loop_sum += value;
+    }
+    auto duration = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start);
+    cout << "+= loop: "s << duration.count() << " ms, "s << loop_sum << endl;
+
+    start = chrono::steady_clock::now();
+    const Rational sum = Sum(values.begin(), values.end());
+    duration = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start);
+    cout << "Sum: "s << duration.count() << " ms, "s << sum << endl;
+}
+
+// One simulation step, position += dt * velocity, then a scale and a
+// translation, step_count times over point_count points: the scalar loop
+// over vector<Vector2D> against the Vector2DArray kernels
+void BenchmarkVector2DArray(int point_count, int step_count) {
+    mt19937 generator(42);
+    uniform_real_distribution<double> coordinate(-1.0, 1.0);
+    vector<Vector2D<double>> positions(point_count);
+    vector<Vector2D<double>> velocities(point_count);
+    for (int i = 0; i < point_count; ++i) {
+        positions[i] = {coordinate(generator), coordinate(generator)};
+        velocities[i] = {coordinate(generator), coordinate(generator)};
+    }
+    const double dt = 0.01;
+    const double damping = 0.999;
+    const Vector2D<double> drift{0.001, -0.001};
+
+    Vector2DArray array_positions(positions);
+    const Vector2DArray array_velocities(velocities);
+
+    auto start = chrono::steady_clock::now();
+    for (int step = 0; step < step_count; ++step) {
+        for (int i = 0; i < point_count; ++i) {
+            positions[i] = (positions[i] + dt * velocities[i]) * damping + drift;
+        }
+    }
+    auto duration = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start);
+    cout << "vector<Vector2D> scalar loop: "s << duration.count() << " ms, first point "s << positions[0] << endl;
+
+    start = chrono::steady_clock::now();
+    for (int step = 0; step < step_count; ++step) {
+        array_positions.AxpyAffine(dt, array_velocities, damping, drift);
+    }
+    duration = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start);
+    cout << "Vector2DArray kernels: "s << duration.count() << " ms, first point "s << Vector2D<double>(array_positions[0]) << endl;
+
+    // The reductions are where the layout pays off: the scalar loop cannot
+    // keep the x and y halves of a register apart
+    start = chrono::steady_clock::now();
+    double scalar_checksum = 0;
+    for (int step = 0; step < step_count; ++step) {
+        double maximum = 0;
+        Vector2D<double> lowest = positions[0];
+        Vector2D<double> highest = positions[0];
+        for (const Vector2D<double>& point : positions) {
+            maximum = max(maximum, point.x * point.x + point.y * point.y);
+            lowest = {min(lowest.x, point.x), min(lowest.y, point.y)};
+            highest = {max(highest.x, point.x), max(highest.y, point.y)};
+        }
+        scalar_checksum += sqrt(maximum) + lowest.x + highest.y;
+    }
+    duration = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start);
+    cout << "vector<Vector2D> max norm and bounding box: "s << duration.count() << " ms, checksum "s << scalar_checksum << endl;
+
+    start = chrono::steady_clock::now();
+    double array_checksum = 0;
+    for (int step = 0; step < step_count; ++step) {
+        const auto [lowest, highest] = array_positions.BoundingBox();
+        array_checksum += array_positions.MaxNorm() + lowest.x + highest.y;
+    }
+    duration = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start);
+    cout << "Vector2DArray max norm and bounding box: "s << duration.count() << " ms, checksum "s << array_checksum << endl;
+}
+
+void BenchmarkRational(int pair_count) {
+    mt19937 generator(42);
+    vector<pair<int, int>> parts(2 * pair_count);
+    for (auto& [numerator, denominator] : parts) {
+        numerator = 1 + generator() % 999;
+        denominator = 1 + generator() % 999;
+    }
+    BenchmarkArithmetic<LegacyRational>("int, subtraction gcd"s, parts);
+    BenchmarkArithmetic<Rational>("int64_t, binary gcd, 128-bit"s, parts);
+}
+
+// int main() {
+//     TestRational();
+//     TestRationalReduction();
+//     TestConstexpr();
+//     TestVector2DArray();
+//     BenchmarkRational(1'000'000);
+//     BenchmarkVector2DArray(1'000'000, 100);
+//     BenchmarkRationalSum(10'000'000);
+// }
+
 int main() {
     const Rational one_third(1, 3);
     const Rational one_sixth{1,6};
@@ -1,51 +1,211 @@
+#include <charconv>
 #include <iostream>
-#include <vector>
-#include <set>
+#include <iterator>
 #include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 using namespace std;
 
+// Anything with begin and end, except strings, which print as text
+template <typename T, typename = void>
+struct IsPrintableRange : false_type {};
+
+template <typename T>
+struct IsPrintableRange<T, void_t<decltype(begin(declval<const T&>())), decltype(end(declval<const T&>()))>>
+    : bool_constant<!is_convertible_v<const T&, string_view>> {};
+
+// Sets print in braces and maps as {key: value, ...}; other ranges in brackets
+template <typename T, typename = void>
+struct IsKeyedRange : false_type {};
+
+template <typename T>
+struct IsKeyedRange<T, void_t<typename T::key_type>> : true_type {};
+
+template <typename T, typename = void>
+struct IsMappedRange : false_type {};
+
 template <typename T>
-ostream& operator<<(ostream& out, const vector<T>& container) {
-    out << "["s;
-    int counter = 0;
-    for (const T& element: container) {
-        out << element;
-        if (counter != (container.size() - 1)) {
-            out << ", "s;
+struct IsMappedRange<T, void_t<typename T::key_type, typename T::mapped_type>> : true_type {};
+
+template <typename T>
+struct IsPair : false_type {};
+
+template <typename T, typename U>
+struct IsPair<pair<T, U>> : true_type {};
+
+template <typename T>
+struct IsTuple : false_type {};
+
+template <typename... Types>
+struct IsTuple<tuple<Types...>> : true_type {};
+
+// Formats a whole value into one growable buffer, which is then written
+// to the stream at once. Numbers go through to_chars when the stream
+// uses the classic locale and default flags, which give the same text;
+// anything else is printed by a side stream with the same formatting
+class FormatBuffer {
+public:
+    explicit FormatBuffer(const ostream& format)
+        : format_(format)
+        , flags_(format.flags())
+        , is_classic_(format.getloc() == locale::classic())
+    {}
+
+    void Append(string_view text) {
+        text_.append(text);
+    }
+
+    template <typename T>
+    void AppendValue(const T& value) {
+        if constexpr (is_same_v<T, bool>) {
+            if (flags_ & ios::boolalpha) {
+                Append(value ? "true"sv : "false"sv);
+            } else {
+                text_.push_back(value ? '1' : '0');
+            }
+        } else if constexpr (is_same_v<T, char> || is_same_v<T, signed char> || is_same_v<T, unsigned char>) {
+            text_.push_back(static_cast<char>(value));
+        } else if constexpr (is_integral_v<T> && !is_same_v<T, wchar_t> && !is_same_v<T, char16_t> && !is_same_v<T, char32_t>) {
+            const ios::fmtflags base = flags_ & ios::basefield;
+            if (is_classic_ && (base == ios::dec || base == 0) && !(flags_ & ios::showpos)) {
+                AppendChars(value);
+            } else {
+                AppendStreamed(value);
+            }
+        } else if constexpr (is_floating_point_v<T>) {
+            const ios::fmtflags notation = flags_ & ios::floatfield;
+            if (is_classic_ && !(flags_ & (ios::showpos | ios::showpoint | ios::uppercase))
+                && notation != (ios::fixed | ios::scientific)) {
+                const chars_format format = notation == ios::fixed ? chars_format::fixed
+                                          : notation == ios::scientific ? chars_format::scientific
+                                          : chars_format::general;
+                AppendChars(value, format, static_cast<int>(format_.precision()));
+            } else {
+                AppendStreamed(value);
+            }
+        } else if constexpr (is_convertible_v<const T&, string_view>) {
+            Append(string_view(value));
+        } else if constexpr (IsPair<T>::value) {
+            text_.push_back('(');
+            AppendValue(value.first);
+            Append(", "sv);
+            AppendValue(value.second);
+            text_.push_back(')');
+        } else if constexpr (IsTuple<T>::value) {
+            text_.push_back('(');
+            apply([this](const auto&... elements) {
+                bool is_first = true;
+                ((Append(is_first ? ""sv : ", "sv), AppendValue(elements), is_first = false), ...);
+            }, value);
+            text_.push_back(')');
+        } else if constexpr (IsPrintableRange<T>::value) {
+            AppendRange(value);
+        } else {
+            AppendStreamed(value);
         }
-        ++counter;
     }
-    out << "]"s;
-    return out;
-}
 
-template <typename T>
-ostream& operator<<(ostream& out, const set<T>& container) {
-    out << "{"s;
-    int counter = 0;
-    for (const T& element: container) {
-        out << element;
-        if (counter != (container.size() - 1)) {
-            out << ", "s;
+    // Writes the text padded to the stream width, which, as with element
+    // by element output, applies to the opening bracket only
+    void FlushTo(ostream& out) {
+        const streamsize width = out.width(0);
+        if (width > 1 && !text_.empty()) {
+            const size_t position = (out.flags() & ios::adjustfield) == ios::left ? 1 : 0;
+            text_.insert(position, static_cast<size_t>(width - 1), out.fill());
         }
-        ++counter;
+        out.write(text_.data(), static_cast<streamsize>(text_.size()));
     }
-    out << "}"s;
-    return out;
-}
 
-template <typename T, typename U>
-ostream& operator<<(ostream& out, const map<T, U>& container) {
-    out << "{"s;
-    int counter = 0;
-    for (auto& [key, value]: container) {
-        out << key << ": "s << value;
-        if (counter != (container.size() - 1)) {
-            out << ", "s;
+private:
+    const ostream& format_;
+    const ios::fmtflags flags_;
+    const bool is_classic_;
+    string text_;
+    unique_ptr<ostringstream> side_stream_;
+
+    template <typename Range>
+    void AppendRange(const Range& range) {
+        constexpr bool is_keyed = IsKeyedRange<Range>::value;
+        text_.push_back(is_keyed ? '{' : '[');
+        bool is_first = true;
+        for (const auto& element : range) {
+            if (!is_first) {
+                Append(", "sv);
+            }
+            is_first = false;
+            if constexpr (IsMappedRange<Range>::value) {
+                AppendValue(element.first);
+                Append(": "sv);
+                AppendValue(element.second);
+            } else {
+                AppendValue(element);
+            }
         }
-        ++counter;
+        text_.push_back(is_keyed ? '}' : ']');
     }
-    out << "}"s;
+
+    // 64 characters hold any integer and any float in general or
+    // scientific form; a longer fixed form is written straight into the
+    // buffer, grown until it fits
+    template <typename T, typename... Format>
+    void AppendChars(T value, Format... format) {
+        char chars[64];
+        const auto [end, error] = to_chars(chars, chars + sizeof(chars), value, format...);
+        if (error == errc{}) {
+            text_.append(chars, end);
+            return;
+        }
+        const size_t size = text_.size();
+        for (size_t room = 4 * sizeof(chars);; room *= 4) {
+            text_.resize(size + room);
+            const to_chars_result result = to_chars(text_.data() + size, text_.data() + text_.size(), value, format...);
+            if (result.ec == errc{}) {
+                text_.resize(result.ptr - text_.data());
+                return;
+            }
+        }
+    }
+
+    template <typename T>
+    void AppendStreamed(const T& value) {
+        if (!side_stream_) {
+            side_stream_ = make_unique<ostringstream>();
+            side_stream_->copyfmt(format_);
+            side_stream_->width(0);
+        }
+        side_stream_->str(""s);
+        *side_stream_ << value;
+        Append(side_stream_->str());
+    }
+};
+
+template <typename T>
+ostream& PrintFormatted(ostream& out, const T& value) {
+    FormatBuffer buffer(out);
+    buffer.AppendValue(value);
+    buffer.FlushTo(out);
     return out;
-}
\ No newline at end of file
+}
+
+template <typename Range, enable_if_t<IsPrintableRange<Range>::value, int> = 0>
+ostream& operator<<(ostream& out, const Range& range) {
+    return PrintFormatted(out, range);
+}
+
+template <typename T, typename U>
+ostream& operator<<(ostream& out, const pair<T, U>& value) {
+    return PrintFormatted(out, value);
+}
+
+template <typename... Types>
+ostream& operator<<(ostream& out, const tuple<Types...>& value) {
+    return PrintFormatted(out, value);
+}
@@ -1,4 +1,5 @@
 #include <iostream>
+#include <atomic>
 #include <algorithm>
 #include <vector>
 #include <set>
@@ -7,12 +8,25 @@
 #include <cmath>
 #include <numeric>
 #include <optional>
+#include <string_view>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <iomanip>
+#include <sstream>
+#include <tuple>
+#include <unordered_map>
 #include "print-templates.cpp"
+#include "synonyms-lib.cpp"
 #include "unit-tests-lib.cpp"
 
 using namespace std;
 
 const int MAX_RESULT_DOCUMENT_COUNT = 5;
+const int MAX_PREFIX_EXPANSION = 128;
+const size_t MAX_SYNONYM_GROUP_CACHE_SIZE = 4096;
 const double EPSILON = 1e-6;
 
 string ReadLine() {
@@ -49,9 +63,202 @@ enum class DocumentStatus {
             REMOVED,
         };
 
+// Bits per quantized score in the impact-ordered index
+enum class ImpactPrecision {
+    BITS_8 = 8,
+    BITS_16 = 16,
+};
+
+// How far impact-ordered scores are from exact double scores
+struct ImpactIndexReport {
+    int bits = 0;
+    double max_abs_error = 0.0;
+    double mean_abs_error = 0.0;
+    // Documents added since the last rebuild, scored with old statistics
+    int stale_document_count = 0;
+};
+
+// Bytes used by each part of a SearchServer, node-based containers
+// counted together with their allocator overhead
+struct MemoryUsageReport {
+    size_t term_dictionary = 0;
+    size_t postings = 0;
+    size_t impact_index = 0;
+    size_t positional_index = 0;
+    size_t document_data = 0;
+    size_t added_ids = 0;
+    size_t stop_words = 0;
+    // Bucket i counts values in [2^i, 2^(i+1))
+    vector<size_t> terms_per_document_histogram;
+    vector<size_t> postings_per_term_histogram;
+
+    size_t Total() const {
+        return term_dictionary + postings + impact_index + positional_index + document_data + added_ids + stop_words;
+    }
+};
+
 struct Query {
     set<string> plus_words;
     set<string> minus_words;
+    // Prefixes of words written as "кот*", stored without the star
+    set<string> plus_prefixes;
+    set<string> minus_prefixes;
+    // Words of each "quoted phrase"; they are plus words as well
+    vector<vector<string>> phrases;
+    bool has_open_phrase = false;
+};
+
+// Term dictionary. All terms are stored back to back in one arena and
+// found through a hash table of ids, so a term costs its bytes plus a few
+// ints instead of a whole map node. Ids are dense and given in order of
+// appearance. For prefix lookups the ids are also kept in runs sorted by
+// term, each at least twice as long as the next: new terms go into a
+// short last run, and full runs merge like a binary counter, so adding n
+// terms takes O(n log n) comparisons instead of the O(n^2) moves of
+// inserting each id in place into one sorted vector
+class TermDictionary {
+public:
+    inline static constexpr int NO_TERM = WordTable::NO_WORD;
+
+    int Insert(const string& term) {
+        const int term_count = terms_.GetSize();
+        const int id = terms_.Intern(term);
+        if (id == term_count) {
+            if (sorted_runs_.empty() || sorted_runs_.back().size() >= MIN_MERGED_RUN) {
+                sorted_runs_.emplace_back();
+            }
+            vector<int>& last_run = sorted_runs_.back();
+            last_run.insert(LowerBound(last_run, term), id);
+            if (last_run.size() == MIN_MERGED_RUN) {
+                MergeFullRuns();
+            }
+        }
+        return id;
+    }
+
+    int Find(string_view term) const {
+        return terms_.Find(term);
+    }
+
+    // Returns ids of terms starting with the prefix in term order, at
+    // most max_count of them, walking all sorted runs at once
+    vector<int> ExpandPrefix(string_view prefix, size_t max_count) const {
+        vector<pair<vector<int>::const_iterator, vector<int>::const_iterator>> ranges;
+        for (const vector<int>& run : sorted_runs_) {
+            auto it = LowerBound(run, prefix);
+            if (HasPrefix(it, run.end(), prefix)) {
+                ranges.emplace_back(it, run.end());
+            }
+        }
+        vector<int> term_ids;
+        while (!ranges.empty() && term_ids.size() < max_count) {
+            auto first = min_element(ranges.begin(), ranges.end(), [this](const auto& lhs, const auto& rhs) {
+                return GetTerm(*lhs.first) < GetTerm(*rhs.first);
+            });
+            term_ids.push_back(*first->first++);
+            if (!HasPrefix(first->first, first->second, prefix)) {
+                ranges.erase(first);
+            }
+        }
+        return term_ids;
+    }
+
+    string_view GetTerm(int term_id) const {
+        return terms_.GetWord(term_id);
+    }
+
+    size_t GetTermCount() const {
+        return terms_.GetSize();
+    }
+
+    size_t GetMemoryUsage() const {
+        size_t memory = terms_.GetMemoryUsage() + sorted_runs_.capacity() * sizeof(vector<int>);
+        for (const vector<int>& run : sorted_runs_) {
+            memory += run.capacity() * sizeof(int);
+        }
+        return memory;
+    }
+
+private:
+    inline static constexpr size_t MIN_MERGED_RUN = 64;
+
+    WordTable terms_;
+    vector<vector<int>> sorted_runs_;
+
+    vector<int>::const_iterator LowerBound(const vector<int>& ids, string_view term) const {
+        return lower_bound(ids.begin(), ids.end(), term,
+                           [this](int term_id, string_view value) { return GetTerm(term_id) < value; });
+    }
+
+    bool HasPrefix(vector<int>::const_iterator it, vector<int>::const_iterator end, string_view prefix) const {
+        return it != end && GetTerm(*it).substr(0, prefix.size()) == prefix;
+    }
+
+    void MergeFullRuns() {
+        while (sorted_runs_.size() > 1 && sorted_runs_[sorted_runs_.size() - 2].size() <= sorted_runs_.back().size()) {
+            vector<int>& lhs = sorted_runs_[sorted_runs_.size() - 2];
+            const vector<int>& rhs = sorted_runs_.back();
+            vector<int> merged_ids;
+            merged_ids.reserve(lhs.size() + rhs.size());
+            merge(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), back_inserter(merged_ids),
+                  [this](int lhs_id, int rhs_id) { return GetTerm(lhs_id) < GetTerm(rhs_id); });
+            lhs = move(merged_ids);
+            sorted_runs_.pop_back();
+        }
+    }
+};
+
+// A query parsed and resolved against one SearchServer, so it can be
+// executed many times without tokenizing or dictionary lookups. Any
+// server runs it: one that did not resolve it, or whose dictionary has
+// grown since, resolves it again in place, so a query must not run on
+// several threads at once while the index changes
+class PreparedQuery {
+public:
+    bool IsValid() const {
+        return is_valid_;
+    }
+
+private:
+    template <typename RankingPolicy>
+    friend class BasicSearchServer;
+
+    struct Term {
+        int term_id;
+        const map<int, double>* postings;
+    };
+
+    Query query_;
+    bool is_valid_ = false;
+    // The resolution, pointing into the postings of one server
+    mutable vector<Term> plus_terms_;
+    mutable vector<Term> minus_terms_;
+    // Term ids of each phrase, NO_TERM for a word not in the index
+    mutable vector<vector<int>> phrase_terms_;
+    // Merged synonym postings some plus terms point into
+    mutable vector<shared_ptr<const map<int, double>>> merged_postings_;
+    mutable bool is_expanded_ = false;
+    // Server and dictionary state the terms were resolved against
+    mutable uint64_t server_id_ = 0;
+    mutable size_t term_count_ = 0;
+    mutable size_t max_prefix_expansion_ = 0;
+};
+
+// Results of one query, scored once and handed out page by page, best
+// first. A cursor stays valid while its server's index does not change
+class ResultCursor {
+public:
+    size_t GetRemainingCount() const {
+        return heap_.size();
+    }
+
+private:
+    template <typename RankingPolicy>
+    friend class BasicSearchServer;
+
+    // Max-heap by rank, see BasicSearchServer::IsRankedBefore
+    vector<Document> heap_;
+    uint64_t index_generation_ = 0;
 };
 
 template <typename StringCollection>
@@ -60,18 +267,102 @@ set<string> MakeSetStopWords(const StringCollection& collection) {
     return set_words;
 }
 
-class SearchServer {
+// A ranking policy scores one query term in one document. It declares
+// the statistics it needs of every document and of the whole collection,
+// and the server keeps only those. Term frequencies come normalized by
+// document length, as the postings store them. The server is compiled
+// for one policy, so the scorer is inlined into the loops over postings
+struct TfIdfRanking {
+    struct DocumentStatistics {};
+
+    struct CollectionStatistics {
+        void Add(const DocumentStatistics&) {}
+    };
+
+    struct TermScorer {
+        double inverse_document_freq = 0.0;
+
+        double operator()(double term_freq, const DocumentStatistics&) const {
+            return term_freq * inverse_document_freq;
+        }
+    };
+
+    static DocumentStatistics MakeDocumentStatistics(size_t) {
+        return {};
+    }
+
+    static TermScorer MakeTermScorer(const CollectionStatistics&, int document_count, size_t document_freq) {
+        return {log(document_count / static_cast<double>(document_freq))};
+    }
+};
+
+// Okapi BM25: term counts saturate, and long documents weigh less than
+// the average one. Keeps the length of every document to recover counts
+// from term frequencies, and the total length for the average
+struct Bm25Ranking {
+    inline static constexpr double K1 = 1.2;
+    inline static constexpr double B = 0.75;
+
+    struct DocumentStatistics {
+        int length = 0;
+    };
+
+    struct CollectionStatistics {
+        int64_t total_length = 0;
+
+        void Add(const DocumentStatistics& document) {
+            total_length += document.length;
+        }
+    };
+
+    struct TermScorer {
+        double inverse_document_freq = 0.0;
+        // K1 * B divided by the average length, and K1 * (1 - B)
+        double length_weight = 0.0;
+        double base_weight = K1 * (1 - B);
+
+        double operator()(double term_freq, const DocumentStatistics& document) const {
+            const double term_count = term_freq * document.length;
+            return inverse_document_freq * term_count * (K1 + 1)
+                / (term_count + base_weight + length_weight * document.length);
+        }
+    };
+
+    static DocumentStatistics MakeDocumentStatistics(size_t word_count) {
+        return {static_cast<int>(word_count)};
+    }
+
+    // Uses the idf that stays positive for terms in most documents
+    static TermScorer MakeTermScorer(const CollectionStatistics& collection, int document_count, size_t document_freq) {
+        TermScorer scorer;
+        scorer.inverse_document_freq = log(1.0 + (document_count - document_freq + 0.5) / (document_freq + 0.5));
+        if (collection.total_length > 0) {
+            scorer.length_weight = K1 * B * document_count / collection.total_length;
+        }
+        return scorer;
+    }
+};
+
+template <typename RankingPolicy>
+class BasicSearchServer {
 public:
     inline static constexpr int INVALID_DOCUMENT_ID = -1;
 
-    SearchServer() = default;
+    BasicSearchServer() = default;
+
+    // Term ids and prepared queries point into word_in_document_freqs_,
+    // so a server can be moved but not copied
+    BasicSearchServer(const BasicSearchServer&) = delete;
+    BasicSearchServer& operator=(const BasicSearchServer&) = delete;
+    BasicSearchServer(BasicSearchServer&&) = default;
+    BasicSearchServer& operator=(BasicSearchServer&&) = default;
 
     template <typename StringCollection>
-    explicit SearchServer(const StringCollection& stop_words)
+    explicit BasicSearchServer(const StringCollection& stop_words)
         : stop_words_(MakeSetStopWords(stop_words))
     {}
 
-    explicit SearchServer(const string& stop_words_text)
+    explicit BasicSearchServer(const string& stop_words_text)
         : stop_words_(MakeSetStopWords(SplitIntoWords(stop_words_text)))
     {}
 
@@ -81,6 +372,120 @@ public:
             }
     }
 
+    // Limits the number of terms a single "prefix*" word may expand to;
+    // "-prefix*" words always exclude every term they match
+    void SetMaxPrefixExpansion(size_t max_expansion) {
+        max_prefix_expansion_ = max_expansion;
+    }
+
+    const TermDictionary& GetTermDictionary() const {
+        return term_dictionary_;
+    }
+
+    // Turns on the impact-ordered index: per-posting scores quantized to
+    // the given precision, highest first, so short queries stop early
+    void EnableImpactIndex(ImpactPrecision precision) {
+        impact_bits_ = static_cast<int>(precision);
+        RebuildImpactIndex();
+    }
+
+    void DisableImpactIndex() {
+        impact_bits_ = 0;
+        impact_postings_.clear();
+    }
+
+    // Keeps the positions of every term in documents added from now on,
+    // which "quoted phrase" queries need. The text of earlier documents
+    // is gone, so they never match a phrase
+    void EnablePositionalIndex() {
+        has_positional_index_ = true;
+    }
+
+    // Recomputes term scorers and quantization scale; documents added
+    // since the previous rebuild were indexed with stale statistics
+    void RebuildImpactIndex() {
+        if (impact_bits_ == 0) {
+            return;
+        }
+        impact_postings_.assign(term_postings_.size(), {});
+        double max_impact = 0.0;
+        for (size_t term_id = 0; term_id < term_postings_.size(); ++term_id) {
+            const map<int, double>& postings = *term_postings_[term_id];
+            impact_postings_[term_id].score = MakeTermScorer(postings.size());
+            for (const auto& [document_id, term_freq] : postings) {
+                max_impact = max(max_impact, impact_postings_[term_id].score(term_freq, GetDocumentStatistics(document_id)));
+            }
+        }
+        const int max_level = (1 << impact_bits_) - 1;
+        impact_scale_ = max_impact > 0.0 ? max_impact / max_level : 1.0;
+        vector<pair<int, int>> impacts;
+        for (size_t term_id = 0; term_id < term_postings_.size(); ++term_id) {
+            ImpactPostings& postings = impact_postings_[term_id];
+            impacts.clear();
+            for (const auto& [document_id, term_freq] : *term_postings_[term_id]) {
+                impacts.emplace_back(QuantizeImpact(postings.score(term_freq, GetDocumentStatistics(document_id))), document_id);
+            }
+            stable_sort(impacts.begin(), impacts.end(), IsHigherImpact);
+            SetImpacts(postings, impacts);
+        }
+        impact_document_count_ = document_count_;
+    }
+
+    // Built from counters kept by AddDocument, so it never walks postings
+    MemoryUsageReport GetMemoryUsage() const {
+        MemoryUsageReport report;
+        report.term_dictionary = term_dictionary_.GetMemoryUsage();
+        report.postings = word_in_document_freqs_.size() * GetNodeSize<pair<const string, map<int, double>>>()
+            + postings_key_bytes_
+            + posting_count_ * GetNodeSize<pair<const int, double>>()
+            + term_postings_.capacity() * sizeof(const map<int, double>*);
+        report.impact_index = impact_postings_.capacity() * sizeof(ImpactPostings);
+        for (const ImpactPostings& postings : impact_postings_) {
+            report.impact_index += postings.document_ids.capacity() * sizeof(int) + postings.impacts.capacity();
+        }
+        report.positional_index = positional_postings_.capacity() * sizeof(PositionalPostings);
+        for (const PositionalPostings& postings : positional_postings_) {
+            report.positional_index += postings.document_ids.capacity() * sizeof(int)
+                + postings.offsets.capacity() * sizeof(uint32_t)
+                + postings.positions.capacity();
+        }
+        report.document_data = document_data_.size() * GetNodeSize<pair<const int, DocumentData>>()
+            + statistics_ids_.capacity() * sizeof(int)
+            + document_statistics_.capacity() * sizeof(DocumentStatistics);
+        report.added_ids = added_ids_.capacity() * sizeof(int);
+        report.stop_words = stop_words_.size() * GetNodeSize<string>();
+        for (const string& word : stop_words_) {
+            report.stop_words += GetHeapSize(word);
+        }
+        report.terms_per_document_histogram = terms_per_document_histogram_;
+        report.postings_per_term_histogram = postings_per_term_histogram_;
+        return report;
+    }
+
+    ImpactIndexReport GetImpactIndexReport() const {
+        ImpactIndexReport report;
+        report.bits = impact_bits_;
+        if (impact_bits_ == 0) {
+            return report;
+        }
+        report.stale_document_count = document_count_ - impact_document_count_;
+        size_t posting_count = 0;
+        for (size_t term_id = 0; term_id < term_postings_.size(); ++term_id) {
+            const map<int, double>& postings = *term_postings_[term_id];
+            const TermScorer score = MakeTermScorer(postings.size());
+            for (const auto& [document_id, term_freq] : postings) {
+                const double error = abs(GetImpactScore(term_id, document_id) - score(term_freq, GetDocumentStatistics(document_id)));
+                report.max_abs_error = max(report.max_abs_error, error);
+                report.mean_abs_error += error;
+                ++posting_count;
+            }
+        }
+        if (posting_count != 0) {
+            report.mean_abs_error /= posting_count;
+        }
+        return report;
+    }
+
     [[nodiscard]] bool AddDocument(int document_id, const string& document, 
                     const DocumentStatus& document_status, 
                     const vector<int>& doc_ratings) {
@@ -96,36 +501,89 @@ public:
             }
         }
 
+        const DocumentStatistics statistics = RankingPolicy::MakeDocumentStatistics(document_words.size());
         document_data_[document_id] = {ComputeAverageRating(doc_ratings), document_status};
+        InsertDocumentStatistics(document_id, statistics);
         const double inv_words_count = 1.0 / document_words.size();
+        set<int> document_term_ids;
+        map<int, vector<int>> term_positions;
+        int position = 0;
         for (const string& word : document_words) {
-            word_in_document_freqs_[word][document_id] += inv_words_count;
+            const auto [it, is_new_word] = word_in_document_freqs_.try_emplace(word);
+            if (is_new_word) {
+                postings_key_bytes_ += GetHeapSize(it->first);
+            }
+            map<int, double>& postings = it->second;
+            postings[document_id] += inv_words_count;
+            const int term_id = term_dictionary_.Insert(word);
+            if (term_id == static_cast<int>(term_postings_.size())) {
+                term_postings_.push_back(&postings);
+            }
+            document_term_ids.insert(term_id);
+            if (has_positional_index_) {
+                term_positions[term_id].push_back(position);
+            }
+            ++position;
         }
         ++document_count_;
+        collection_statistics_.Add(statistics);
+
+        posting_count_ += document_term_ids.size();
+        AddToHistogram(terms_per_document_histogram_, document_term_ids.size(), 1);
+        for (const int term_id : document_term_ids) {
+            const size_t postings_size = term_postings_[term_id]->size();
+            if (postings_size > 1) {
+                AddToHistogram(postings_per_term_histogram_, postings_size - 1, -1);
+            }
+            AddToHistogram(postings_per_term_histogram_, postings_size, 1);
+        }
+
+        if (impact_bits_ != 0) {
+            for (const int term_id : document_term_ids) {
+                if (term_id == static_cast<int>(impact_postings_.size())) {
+                    impact_postings_.push_back({MakeTermScorer(1), {}, {}});
+                }
+                AppendImpact(term_id, document_id, term_postings_[term_id]->at(document_id));
+            }
+        }
+        for (const auto& [term_id, positions] : term_positions) {
+            InsertPositions(term_id, document_id, positions);
+        }
+        index_generation_ = MakeIndexGeneration();
         return true;
     }
 
+    PreparedQuery PrepareQuery(const string& query_text) const {
+        PreparedQuery prepared_query;
+        prepared_query.query_ = ParseQuery(query_text);
+        prepared_query.is_valid_ = IsValidQuery(prepared_query.query_);
+        if (prepared_query.is_valid_) {
+            ResolvePreparedQuery(prepared_query);
+        }
+        return prepared_query;
+    }
+
     template <typename DocumentPredicate>
     optional<vector<Document>> FindTopDocuments(const string& query_text, DocumentPredicate filter) const {
-        
-        const Query query = ParseQuery(query_text);
+        return FindTopDocuments(PrepareQuery(query_text), filter);
+    }
 
-        for (const string& word: query.minus_words) {
-            if (count(word.begin(), word.end(), '-') > 0 || word.empty()) {
-                return nullopt;
-            }
+    template <typename DocumentPredicate>
+    optional<vector<Document>> FindTopDocuments(const PreparedQuery& prepared_query, DocumentPredicate filter) const {
+        if (!prepared_query.IsValid() || !CanAnswerPhrases(prepared_query)) {
+            return nullopt;
         }
 
-        vector<Document> matched_documents = FindAllDocuments(query, filter);
+        const PreparedQuery& query = RefreshIfOutdated(prepared_query);
+
+        vector<Document> matched_documents = CanUseImpactIndex(query)
+            ? FindImpactDocuments(query, filter)
+            : FindAllDocuments(query, filter);
 
         sort(execution::par, 
                 matched_documents.begin(),
                 matched_documents.end(),
-                [](const Document& lhs, const Document& rhs) {
-                return (abs(lhs.relevance - rhs.relevance) < EPSILON) 
-                        && lhs.rating > rhs.rating
-                        || lhs.relevance > rhs.relevance;
-        });
+                IsRankedBefore);
 
         if (matched_documents.size() > MAX_RESULT_DOCUMENT_COUNT) {
             matched_documents.resize(MAX_RESULT_DOCUMENT_COUNT);
@@ -142,6 +600,89 @@ public:
         return FindTopDocuments(query, DocumentStatus::ACTUAL);
     }
 
+    optional<vector<Document>> FindTopDocuments(const PreparedQuery& query, DocumentStatus status) const {
+        return FindTopDocuments(query, [status](int, DocumentStatus doc_status, int) { return doc_status == status; });
+    }
+
+    optional<vector<Document>> FindTopDocuments(const PreparedQuery& query) const {
+        return FindTopDocuments(query, DocumentStatus::ACTUAL);
+    }
+
+    // Each plus word also matches its direct synonyms, not the words they
+    // are synonyms of in turn. The postings of a word and its synonyms
+    // are merged once and scored as a single term; merged lists are
+    // cached until the index or the dictionary changes, so such searches
+    // must not run concurrently on one server
+    template <typename DocumentPredicate>
+    optional<vector<Document>> FindTopDocuments(const string& query_text, const Synonyms& synonyms, DocumentPredicate filter) const {
+        PreparedQuery query = PrepareQuery(query_text);
+        if (query.IsValid()) {
+            ExpandSynonyms(query, synonyms);
+        }
+        return FindTopDocuments(query, filter);
+    }
+
+    optional<vector<Document>> FindTopDocuments(const string& query, const Synonyms& synonyms, DocumentStatus status) const {
+        return FindTopDocuments(query, synonyms, [status](int, DocumentStatus doc_status, int) { return doc_status == status; });
+    }
+
+    optional<vector<Document>> FindTopDocuments(const string& query, const Synonyms& synonyms) const {
+        return FindTopDocuments(query, synonyms, DocumentStatus::ACTUAL);
+    }
+
+    // Scores every matching document once, exactly, for paging through
+    // the results with NextPage
+    template <typename DocumentPredicate>
+    optional<ResultCursor> OpenCursor(const PreparedQuery& prepared_query, DocumentPredicate filter) const {
+        if (!prepared_query.IsValid() || !CanAnswerPhrases(prepared_query)) {
+            return nullopt;
+        }
+
+        const PreparedQuery& query = RefreshIfOutdated(prepared_query);
+
+        ResultCursor cursor;
+        cursor.heap_ = FindAllDocuments(query, filter);
+        make_heap(cursor.heap_.begin(), cursor.heap_.end(), IsRankedAfter);
+        cursor.index_generation_ = index_generation_;
+        return cursor;
+    }
+
+    template <typename DocumentPredicate>
+    optional<ResultCursor> OpenCursor(const string& query_text, DocumentPredicate filter) const {
+        return OpenCursor(PrepareQuery(query_text), filter);
+    }
+
+    optional<ResultCursor> OpenCursor(const string& query, DocumentStatus status) const {
+        return OpenCursor(query, [status](int, DocumentStatus doc_status, int) { return doc_status == status; });
+    }
+
+    optional<ResultCursor> OpenCursor(const string& query) const {
+        return OpenCursor(query, DocumentStatus::ACTUAL);
+    }
+
+    // Takes the next page_size results off the cursor in O(page_size log n);
+    // fewer at the end, none once it is exhausted. After a document is
+    // added the scores are stale, so the cursor gives nullopt and has to
+    // be opened again
+    optional<vector<Document>> NextPage(ResultCursor& cursor, size_t page_size) const {
+        if (cursor.index_generation_ != index_generation_) {
+            return nullopt;
+        }
+        vector<Document> page;
+        page.reserve(min(page_size, cursor.heap_.size()));
+        while (page.size() < page_size && !cursor.heap_.empty()) {
+            pop_heap(cursor.heap_.begin(), cursor.heap_.end(), IsRankedAfter);
+            page.push_back(cursor.heap_.back());
+            cursor.heap_.pop_back();
+        }
+        return page;
+    }
+
+    // Changes whenever a document is added; no two servers share one
+    uint64_t GetIndexGeneration() const {
+        return index_generation_;
+    }
+
     function<int(vector<int>)> GetComputeAverageRatingFunc() {
         auto func = ComputeAverageRating;
         return func;
@@ -155,30 +696,32 @@ public:
     }
 
     optional<tuple<vector<string>, DocumentStatus>> MatchDocument(const string& raw_query, int document_id, tuple<vector<string>, DocumentStatus>& result) const {
-        const Query query = ParseQuery(raw_query);
+        return MatchDocument(PrepareQuery(raw_query), document_id, result);
+    }
 
-        for (const string& word: query.minus_words) {
-            if (count(word.begin(), word.end(), '-') > 0 || word.empty()) {
-                return nullopt;
-            }
+    optional<tuple<vector<string>, DocumentStatus>> MatchDocument(const PreparedQuery& prepared_query, int document_id, tuple<vector<string>, DocumentStatus>& result) const {
+        if (!prepared_query.IsValid() || !CanAnswerPhrases(prepared_query)) {
+            return nullopt;
         }
 
+        const PreparedQuery& query = RefreshIfOutdated(prepared_query);
+
         vector<string> matched_words;
-        for (const string& word : query.plus_words) {
-            if (word_in_document_freqs_.count(word) == 0) {
-                continue;
+        for (const PreparedQuery::Term& term : query.plus_terms_) {
+            if (term.postings->count(document_id)) {
+                matched_words.emplace_back(term_dictionary_.GetTerm(term.term_id));
             }
+        }
+        sort(matched_words.begin(), matched_words.end());
 
-            if (word_in_document_freqs_.at(word).count(document_id)) {
-                matched_words.push_back(word);
+        for (const PreparedQuery::Term& term : query.minus_terms_) {
+            if (term.postings->count(document_id)) {
+                matched_words.clear();
+                break;
             }
         }
-        for (const string& word : query.minus_words) {
-            if (word_in_document_freqs_.count(word) == 0) {
-                continue;
-            }
-
-            if (word_in_document_freqs_.at(word).count(document_id)) {
+        for (const vector<int>& phrase : query.phrase_terms_) {
+            if (!HasPhrase(phrase, document_id)) {
                 matched_words.clear();
                 break;
             }
@@ -188,22 +731,157 @@ public:
 
 // PRIVATE //
 private:
+    using DocumentStatistics = typename RankingPolicy::DocumentStatistics;
+    using TermScorer = typename RankingPolicy::TermScorer;
+
     static bool IsValidWord(const string& word) {
         // A valid word must not contain special characters
         return none_of(word.begin(), word.end(), [](char c) {
             return c >= '\0' && c < ' ';});
     }
 
+    static bool IsValidQuery(const Query& query) {
+        for (const string& word: query.minus_words) {
+            if (count(word.begin(), word.end(), '-') > 0 || word.empty()) {
+                return false;
+            }
+        }
+        for (const string& prefix: query.minus_prefixes) {
+            if (count(prefix.begin(), prefix.end(), '-') > 0 || prefix.empty()) {
+                return false;
+            }
+        }
+        // A bare "*" would expand to the whole dictionary
+        return !query.has_open_phrase
+            && none_of(query.plus_prefixes.begin(), query.plus_prefixes.end(),
+                       [](const string& prefix) { return prefix.empty(); });
+    }
+
     struct DocumentData {
         int rating;
         DocumentStatus status;
     };
 
+    // Terms of a word and its direct synonyms found in the index, and
+    // their postings merged with term frequencies summed
+    struct SynonymGroup {
+        vector<int> term_ids;
+        shared_ptr<const map<int, double>> postings;
+    };
+
+    // Synonym groups by word, valid for one dictionary generation and
+    // one index generation
+    struct SynonymGroupCache {
+        uint64_t synonyms_generation = 0;
+        uint64_t index_generation = 0;
+        map<string, SynonymGroup, less<>> groups;
+    };
+
+    // Postings of one term with its positions in each document. Document
+    // ids are ascending; the positions of document_ids[i] are the bytes
+    // from offsets[i] to offsets[i + 1]: gaps between ascending positions,
+    // seven bits per byte with the high bit set on all but the last byte
+    struct PositionalPostings {
+        vector<int> document_ids;
+        vector<uint32_t> offsets = {0};
+        vector<uint8_t> positions;
+    };
+
+    // Postings of one term ordered by quantized impact, highest first,
+    // then the ones added since in any order
+    struct ImpactPostings {
+        TermScorer score;
+        vector<int> document_ids;
+        // One or two little-endian bytes per posting, see impact_bits_
+        vector<uint8_t> impacts;
+        size_t sorted_count = 0;
+    };
+
+    inline static constexpr size_t MIN_IMPACT_TAIL = 64;
+
     map<string, map<int, double>> word_in_document_freqs_;
+    TermDictionary term_dictionary_;
+    // Term id -> its postings inside word_in_document_freqs_
+    vector<const map<int, double>*> term_postings_;
+    size_t max_prefix_expansion_ = MAX_PREFIX_EXPANSION;
+    // Const searches share the cache, so it is only used under the mutex,
+    // which sits behind a pointer to keep the server movable
+    mutable SynonymGroupCache synonym_groups_;
+    unique_ptr<mutex> synonym_groups_mutex_ = make_unique<mutex>();
+    // Term id -> impact-ordered postings, empty unless impact_bits_ != 0
+    vector<ImpactPostings> impact_postings_;
+    // Term id -> positional postings, filled while has_positional_index_
+    vector<PositionalPostings> positional_postings_;
+    bool has_positional_index_ = false;
+    int impact_bits_ = 0;
+    double impact_scale_ = 1.0;
+    int impact_document_count_ = 0;
+    // Counters behind GetMemoryUsage
+    size_t posting_count_ = 0;
+    size_t postings_key_bytes_ = 0;
+    vector<size_t> terms_per_document_histogram_;
+    vector<size_t> postings_per_term_histogram_;
     set<string> stop_words_;
     map<int, DocumentData> document_data_;
+    // Statistics the ranking policy needs, by ascending document id; both
+    // stay empty for a policy that needs none
+    vector<int> statistics_ids_;
+    vector<DocumentStatistics> document_statistics_;
     vector<int> added_ids_;
     int document_count_ = 0;
+    typename RankingPolicy::CollectionStatistics collection_statistics_;
+    uint64_t index_generation_ = MakeIndexGeneration();
+    // Tells prepared queries of this server from those of others; taken
+    // from the same process-wide counter, so it is unique
+    uint64_t server_id_ = MakeIndexGeneration();
+
+    static uint64_t MakeIndexGeneration() {
+        static atomic<uint64_t> last_generation = 0;
+        return ++last_generation;
+    }
+
+    // Higher relevance first; relevance within EPSILON by higher rating
+    static bool IsRankedBefore(const Document& lhs, const Document& rhs) {
+        return (abs(lhs.relevance - rhs.relevance) < EPSILON) 
+                && lhs.rating > rhs.rating
+                || lhs.relevance > rhs.relevance;
+    }
+
+    static bool IsRankedAfter(const Document& lhs, const Document& rhs) {
+        return IsRankedBefore(rhs, lhs);
+    }
+
+    TermScorer MakeTermScorer(size_t document_freq) const {
+        return RankingPolicy::MakeTermScorer(collection_statistics_, document_count_, document_freq);
+    }
+
+    void InsertDocumentStatistics(int document_id, const DocumentStatistics& statistics) {
+        if constexpr (!is_empty_v<DocumentStatistics>) {
+            // Ids usually grow, which makes this an append
+            const size_t index = lower_bound(statistics_ids_.begin(), statistics_ids_.end(), document_id)
+                - statistics_ids_.begin();
+            statistics_ids_.insert(statistics_ids_.begin() + index, document_id);
+            document_statistics_.insert(document_statistics_.begin() + index, statistics);
+        }
+    }
+
+    // A policy that needs no statistics costs no lookup. Walking postings
+    // in id order, pass the same from to every call: the search gallops
+    // on from the previous document
+    DocumentStatistics GetDocumentStatistics(int document_id, size_t& from) const {
+        if constexpr (is_empty_v<DocumentStatistics>) {
+            return {};
+        }
+        else {
+            from = Gallop(statistics_ids_, from, document_id);
+            return document_statistics_[from];
+        }
+    }
+
+    DocumentStatistics GetDocumentStatistics(int document_id) const {
+        size_t from = 0;
+        return GetDocumentStatistics(document_id, from);
+    }
 
     bool CheckId(int id) {
         if (id < 0 || count(added_ids_.begin(), added_ids_.end(), id) == 1) {
@@ -264,26 +942,43 @@ private:
     }
 
     template <typename DocumentPredicate>
-    vector<Document> FindAllDocuments(const Query& query, DocumentPredicate filter) const {
+    vector<Document> FindAllDocuments(const PreparedQuery& query, DocumentPredicate filter) const {
 
         map<int, double> documents_relevance;
-        for (const string& word : query.plus_words) {
-            if (word_in_document_freqs_.count(word) != 0) {
-                const double inverse_document_freq = log(document_count_ / static_cast<double>(word_in_document_freqs_.at(word).size()));
-                for (const auto& [document_id, term_freq]: word_in_document_freqs_.at(word)) {
-                    documents_relevance[document_id] += term_freq * inverse_document_freq;
+        if (!query.phrase_terms_.empty()) {
+            // Only documents with every phrase can match, and there are
+            // usually few, so their relevance is looked up term by term
+            vector<TermScorer> scorers;
+            for (const PreparedQuery::Term& term : query.plus_terms_) {
+                scorers.push_back(MakeTermScorer(term.postings->size()));
+            }
+            for (const int document_id : FindPhraseDocuments(query.phrase_terms_)) {
+                const DocumentStatistics statistics = GetDocumentStatistics(document_id);
+                double& relevance = documents_relevance[document_id];
+                for (size_t i = 0; i < query.plus_terms_.size(); ++i) {
+                    const auto it = query.plus_terms_[i].postings->find(document_id);
+                    if (it != query.plus_terms_[i].postings->end()) {
+                        relevance += scorers[i](it->second, statistics);
+                    }
                 }
             }
         }
-
-        for (const string& word : query.minus_words) {
-            if (word_in_document_freqs_.count(word) != 0) {
-                for (const auto& [document_id, _]: word_in_document_freqs_.at(word)) {
-                    documents_relevance.erase(document_id);
+        else {
+            for (const PreparedQuery::Term& term : query.plus_terms_) {
+                const TermScorer score = MakeTermScorer(term.postings->size());
+                size_t statistics_index = 0;
+                for (const auto& [document_id, term_freq]: *term.postings) {
+                    documents_relevance[document_id] += score(term_freq, GetDocumentStatistics(document_id, statistics_index));
                 }
             }
         }
 
+        for (const PreparedQuery::Term& term : query.minus_terms_) {
+            for (const auto& [document_id, _]: *term.postings) {
+                documents_relevance.erase(document_id);
+            }
+        }
+
         vector<Document> matched_documents;
             for (auto& [document_id, relevance]: documents_relevance) {
                 DocumentStatus status = document_data_.at(document_id).status;
@@ -296,14 +991,557 @@ private:
         return matched_documents;
     }
 
+    // A std::map or std::set node holds three links and a color next to
+    // the value; malloc rounds it up to 16 bytes and adds an 8-byte header
+    template <typename Value>
+    static constexpr size_t GetNodeSize() {
+        return (4 * sizeof(void*) + sizeof(Value) + 8 + 15) / 16 * 16;
+    }
+
+    // Bytes a string allocated outside its own object
+    static size_t GetHeapSize(const string& text) {
+        const char* data = text.data();
+        const char* object = reinterpret_cast<const char*>(&text);
+        if (data >= object && data < object + sizeof(string)) {
+            return 0;
+        }
+        return (text.capacity() + 1 + 8 + 15) / 16 * 16;
+    }
+
+    static void AddToHistogram(vector<size_t>& histogram, size_t value, int delta) {
+        size_t bucket = 0;
+        while (value >>= 1) {
+            ++bucket;
+        }
+        if (histogram.size() <= bucket) {
+            histogram.resize(bucket + 1, 0);
+        }
+        histogram[bucket] += delta;
+    }
+
+    int QuantizeImpact(double impact) const {
+        const int max_level = (1 << impact_bits_) - 1;
+        return min(max_level, static_cast<int>(lround(impact / impact_scale_)));
+    }
+
+    int GetImpactLevel(const ImpactPostings& postings, size_t index) const {
+        if (impact_bits_ == 8) {
+            return postings.impacts[index];
+        }
+        return postings.impacts[2 * index] | (postings.impacts[2 * index + 1] << 8);
+    }
+
+    double GetImpactScore(int term_id, int document_id) const {
+        const ImpactPostings& postings = impact_postings_[term_id];
+        return QuantizeImpact(postings.score(term_postings_[term_id]->at(document_id), GetDocumentStatistics(document_id))) * impact_scale_;
+    }
+
+    // (level, document id) pairs, highest level first
+    static bool IsHigherImpact(const pair<int, int>& lhs, const pair<int, int>& rhs) {
+        return lhs.first > rhs.first;
+    }
+
+    void SetImpactLevel(ImpactPostings& postings, size_t index, int level) const {
+        if (impact_bits_ == 8) {
+            postings.impacts[index] = static_cast<uint8_t>(level);
+        }
+        else {
+            postings.impacts[2 * index] = static_cast<uint8_t>(level & 0xFF);
+            postings.impacts[2 * index + 1] = static_cast<uint8_t>(level >> 8);
+        }
+    }
+
+    void SetImpacts(ImpactPostings& postings, const vector<pair<int, int>>& impacts) const {
+        postings.document_ids.resize(impacts.size());
+        postings.impacts.resize(impacts.size() * impact_bits_ / 8);
+        for (size_t i = 0; i < impacts.size(); ++i) {
+            postings.document_ids[i] = impacts[i].second;
+            SetImpactLevel(postings, i, impacts[i].first);
+        }
+        postings.sorted_count = impacts.size();
+    }
+
+    // Appends to the unsorted tail, which is merged into the sorted part
+    // once it outgrows MIN_IMPACT_TAIL and the square root of that part.
+    // Adding n postings to a term moves O(n sqrt n) of them at worst, when
+    // new documents score higher than old ones, and a query scores at most
+    // O(sqrt n) unsorted postings per term in full
+    void AppendImpact(int term_id, int document_id, double term_freq) {
+        ImpactPostings& postings = impact_postings_[term_id];
+        const int level = QuantizeImpact(postings.score(term_freq, GetDocumentStatistics(document_id)));
+        const size_t size = postings.document_ids.size() + 1;
+        postings.document_ids.resize(size);
+        postings.impacts.resize(size * impact_bits_ / 8);
+        postings.document_ids.back() = document_id;
+        SetImpactLevel(postings, size - 1, level);
+        const size_t tail_size = size - postings.sorted_count;
+        if (tail_size >= MIN_IMPACT_TAIL && tail_size * tail_size > postings.sorted_count) {
+            MergeImpactTail(postings);
+        }
+    }
+
+    // Sorts the tail and merges it in from the back, so sorted postings
+    // above the highest new level stay where they are
+    void MergeImpactTail(ImpactPostings& postings) const {
+        vector<pair<int, int>> tail;
+        for (size_t i = postings.sorted_count; i < postings.document_ids.size(); ++i) {
+            tail.emplace_back(GetImpactLevel(postings, i), postings.document_ids[i]);
+        }
+        stable_sort(tail.begin(), tail.end(), IsHigherImpact);
+        size_t sorted_end = postings.sorted_count;
+        for (size_t index = postings.document_ids.size(); !tail.empty(); ) {
+            --index;
+            if (sorted_end > 0 && GetImpactLevel(postings, sorted_end - 1) < tail.back().first) {
+                --sorted_end;
+                postings.document_ids[index] = postings.document_ids[sorted_end];
+                SetImpactLevel(postings, index, GetImpactLevel(postings, sorted_end));
+            }
+            else {
+                postings.document_ids[index] = tail.back().second;
+                SetImpactLevel(postings, index, tail.back().first);
+                tail.pop_back();
+            }
+        }
+        postings.sorted_count = postings.document_ids.size();
+    }
+
+    bool CanUseImpactIndex(const PreparedQuery& query) const {
+        return impact_bits_ != 0
+            && !query.is_expanded_
+            && query.phrase_terms_.empty()
+            && query.query_.plus_prefixes.empty()
+            && (query.query_.plus_words.size() == 1 || query.query_.plus_words.size() == 2);
+    }
+
+    // Threshold algorithm over the impact-ordered postings of one or two
+    // terms: stops once no unseen document can enter the top results
+    template <typename DocumentPredicate>
+    vector<Document> FindImpactDocuments(const PreparedQuery& query, DocumentPredicate filter) const {
+        vector<int> term_ids;
+        for (const PreparedQuery::Term& term : query.plus_terms_) {
+            term_ids.push_back(term.term_id);
+        }
+
+        vector<Document> matched_documents;
+        priority_queue<double, vector<double>, greater<double>> top_relevance;
+        set<int> seen_ids;
+        const auto add_document = [&](int document_id) {
+            if (!seen_ids.insert(document_id).second) {
+                return;
+            }
+            const bool excluded = any_of(query.minus_terms_.begin(), query.minus_terms_.end(), [document_id](const PreparedQuery::Term& term) {
+                return term.postings->count(document_id) != 0;
+            });
+            const DocumentData& data = document_data_.at(document_id);
+            if (excluded || !filter(document_id, data.status, data.rating)) {
+                return;
+            }
+
+            double relevance = 0.0;
+            for (const int term_id : term_ids) {
+                if (term_postings_[term_id]->count(document_id) != 0) {
+                    relevance += GetImpactScore(term_id, document_id);
+                }
+            }
+            matched_documents.push_back({document_id, relevance, data.rating});
+            top_relevance.push(relevance);
+            if (top_relevance.size() > MAX_RESULT_DOCUMENT_COUNT) {
+                top_relevance.pop();
+            }
+        };
+
+        // Unsorted postings give no bound, so they are all scored first
+        for (const int term_id : term_ids) {
+            const ImpactPostings& postings = impact_postings_[term_id];
+            for (size_t i = postings.sorted_count; i < postings.document_ids.size(); ++i) {
+                add_document(postings.document_ids[i]);
+            }
+        }
+
+        vector<size_t> positions(term_ids.size(), 0);
+        while (true) {
+            double threshold = 0.0;
+            int next_term = -1;
+            int next_level = -1;
+            for (size_t i = 0; i < term_ids.size(); ++i) {
+                const ImpactPostings& postings = impact_postings_[term_ids[i]];
+                if (positions[i] < postings.sorted_count) {
+                    const int level = GetImpactLevel(postings, positions[i]);
+                    threshold += level * impact_scale_;
+                    if (level > next_level) {
+                        next_level = level;
+                        next_term = i;
+                    }
+                }
+            }
+            if (next_term == -1) {
+                break;
+            }
+            if (top_relevance.size() == MAX_RESULT_DOCUMENT_COUNT && top_relevance.top() > threshold + EPSILON) {
+                break;
+            }
+
+            add_document(impact_postings_[term_ids[next_term]].document_ids[positions[next_term]++]);
+        }
+        return matched_documents;
+    }
+
+    bool CanAnswerPhrases(const PreparedQuery& query) const {
+        return has_positional_index_ || query.query_.phrases.empty();
+    }
+
+    void InsertPositions(int term_id, int document_id, const vector<int>& positions) {
+        if (term_id >= static_cast<int>(positional_postings_.size())) {
+            positional_postings_.resize(term_id + 1);
+        }
+        PositionalPostings& postings = positional_postings_[term_id];
+        vector<uint8_t> bytes;
+        int previous = 0;
+        for (const int position : positions) {
+            uint32_t gap = position - previous;
+            previous = position;
+            for (; gap >= 0x80; gap >>= 7) {
+                bytes.push_back(static_cast<uint8_t>(gap | 0x80));
+            }
+            bytes.push_back(static_cast<uint8_t>(gap));
+        }
+        // Ids usually grow, which makes this an append
+        const size_t index = lower_bound(postings.document_ids.begin(), postings.document_ids.end(), document_id)
+            - postings.document_ids.begin();
+        postings.document_ids.insert(postings.document_ids.begin() + index, document_id);
+        postings.positions.insert(postings.positions.begin() + postings.offsets[index], bytes.begin(), bytes.end());
+        postings.offsets.insert(postings.offsets.begin() + index + 1, postings.offsets[index]);
+        for (size_t i = index + 1; i < postings.offsets.size(); ++i) {
+            postings.offsets[i] += bytes.size();
+        }
+    }
+
+    vector<int> DecodePositions(int term_id, size_t index) const {
+        const PositionalPostings& postings = positional_postings_[term_id];
+        vector<int> positions;
+        int position = 0;
+        uint32_t gap = 0;
+        int shift = 0;
+        for (uint32_t i = postings.offsets[index]; i < postings.offsets[index + 1]; ++i) {
+            gap |= static_cast<uint32_t>(postings.positions[i] & 0x7F) << shift;
+            shift += 7;
+            if ((postings.positions[i] & 0x80) == 0) {
+                position += gap;
+                positions.push_back(position);
+                gap = 0;
+                shift = 0;
+            }
+        }
+        return positions;
+    }
+
+    // First index from `from` on whose id is not below document_id: steps
+    // double until they pass it, then a binary search inside the last step
+    static size_t Gallop(const vector<int>& document_ids, size_t from, int document_id) {
+        size_t step = 1;
+        size_t high = from;
+        while (high < document_ids.size() && document_ids[high] < document_id) {
+            from = high + 1;
+            high += step;
+            step *= 2;
+        }
+        high = min(high, document_ids.size());
+        return lower_bound(document_ids.begin() + from, document_ids.begin() + high, document_id) - document_ids.begin();
+    }
+
+    // Whether the terms occur one after another, given the index of the
+    // document in the postings of each term
+    bool HasPhraseAt(const vector<int>& term_ids, const vector<size_t>& indexes) const {
+        vector<int> starts = DecodePositions(term_ids[0], indexes[0]);
+        for (size_t k = 1; k < term_ids.size() && !starts.empty(); ++k) {
+            const vector<int> positions = DecodePositions(term_ids[k], indexes[k]);
+            size_t next = 0;
+            size_t kept = 0;
+            for (const int start : starts) {
+                while (next < positions.size() && positions[next] < start + static_cast<int>(k)) {
+                    ++next;
+                }
+                if (next < positions.size() && positions[next] == start + static_cast<int>(k)) {
+                    starts[kept++] = start;
+                }
+            }
+            starts.resize(kept);
+        }
+        return !starts.empty();
+    }
+
+    bool HasPositions(const vector<int>& term_ids) const {
+        return all_of(term_ids.begin(), term_ids.end(), [this](int term_id) {
+            return term_id != TermDictionary::NO_TERM && term_id < static_cast<int>(positional_postings_.size());
+        });
+    }
+
+    bool HasPhrase(const vector<int>& term_ids, int document_id) const {
+        if (!HasPositions(term_ids)) {
+            return false;
+        }
+        vector<size_t> indexes;
+        for (const int term_id : term_ids) {
+            const vector<int>& document_ids = positional_postings_[term_id].document_ids;
+            const auto it = lower_bound(document_ids.begin(), document_ids.end(), document_id);
+            if (it == document_ids.end() || *it != document_id) {
+                return false;
+            }
+            indexes.push_back(it - document_ids.begin());
+        }
+        return HasPhraseAt(term_ids, indexes);
+    }
+
+    // Ascending ids of the documents with the phrase. Candidates come from
+    // the rarest term, the other postings are galloped through, and only
+    // documents having every term get their positions decoded
+    vector<int> FindPhraseDocuments(const vector<int>& term_ids) const {
+        vector<int> document_ids;
+        if (!HasPositions(term_ids)) {
+            return document_ids;
+        }
+        vector<size_t> order(term_ids.size());
+        iota(order.begin(), order.end(), 0);
+        sort(order.begin(), order.end(), [this, &term_ids](size_t left, size_t right) {
+            return positional_postings_[term_ids[left]].document_ids.size()
+                < positional_postings_[term_ids[right]].document_ids.size();
+        });
+        const vector<int>& candidates = positional_postings_[term_ids[order[0]]].document_ids;
+        vector<size_t> indexes(term_ids.size(), 0);
+        for (size_t i = 0; i < candidates.size(); ++i) {
+            indexes[order[0]] = i;
+            bool has_all_terms = true;
+            for (size_t k = 1; k < order.size() && has_all_terms; ++k) {
+                const vector<int>& ids = positional_postings_[term_ids[order[k]]].document_ids;
+                size_t& index = indexes[order[k]];
+                index = Gallop(ids, index, candidates[i]);
+                if (index == ids.size()) {
+                    return document_ids;
+                }
+                has_all_terms = ids[index] == candidates[i];
+            }
+            if (has_all_terms && HasPhraseAt(term_ids, indexes)) {
+                document_ids.push_back(candidates[i]);
+            }
+        }
+        return document_ids;
+    }
+
+    // Documents with every phrase of the query
+    vector<int> FindPhraseDocuments(const vector<vector<int>>& phrases) const {
+        vector<int> document_ids = FindPhraseDocuments(phrases.front());
+        for (size_t i = 1; i < phrases.size() && !document_ids.empty(); ++i) {
+            const vector<int> phrase_ids = FindPhraseDocuments(phrases[i]);
+            vector<int> common_ids;
+            set_intersection(document_ids.begin(), document_ids.end(), phrase_ids.begin(), phrase_ids.end(),
+                             back_inserter(common_ids));
+            document_ids = move(common_ids);
+        }
+        return document_ids;
+    }
+
+    // Maps query words and prefixes to term ids, each term at most once.
+    // A prefix gives at most max_expansion terms
+    vector<int> ResolveTerms(const set<string>& words, const set<string>& prefixes, size_t max_expansion) const {
+        vector<int> term_ids;
+        set<int> seen_ids;
+        for (const string& word : words) {
+            const int term_id = term_dictionary_.Find(word);
+            if (term_id != TermDictionary::NO_TERM) {
+                term_ids.push_back(term_id);
+                seen_ids.insert(term_id);
+            }
+        }
+        for (const string& prefix : prefixes) {
+            for (const int term_id : term_dictionary_.ExpandPrefix(prefix, max_expansion)) {
+                if (seen_ids.insert(term_id).second) {
+                    term_ids.push_back(term_id);
+                }
+            }
+        }
+        return term_ids;
+    }
+
+    void ResolvePreparedQuery(const PreparedQuery& prepared_query) const {
+        prepared_query.plus_terms_.clear();
+        for (const int term_id : ResolveTerms(prepared_query.query_.plus_words, prepared_query.query_.plus_prefixes,
+                                              max_prefix_expansion_)) {
+            prepared_query.plus_terms_.push_back({term_id, term_postings_[term_id]});
+        }
+        prepared_query.minus_terms_.clear();
+        // A capped minus prefix would let documents with the terms past
+        // the cap through, so minus prefixes expand in full
+        for (const int term_id : ResolveTerms(prepared_query.query_.minus_words, prepared_query.query_.minus_prefixes,
+                                              numeric_limits<size_t>::max())) {
+            prepared_query.minus_terms_.push_back({term_id, term_postings_[term_id]});
+        }
+        prepared_query.phrase_terms_.clear();
+        for (const vector<string>& phrase : prepared_query.query_.phrases) {
+            vector<int>& term_ids = prepared_query.phrase_terms_.emplace_back();
+            for (const string& word : phrase) {
+                term_ids.push_back(term_dictionary_.Find(word));
+            }
+        }
+        prepared_query.merged_postings_.clear();
+        prepared_query.is_expanded_ = false;
+        prepared_query.server_id_ = server_id_;
+        prepared_query.term_count_ = term_dictionary_.GetTermCount();
+        prepared_query.max_prefix_expansion_ = max_prefix_expansion_;
+    }
+
+    // Terms added to the index after preparation may now match the query,
+    // and a query of another server points into its postings, so such a
+    // query is resolved again. The result is kept for later runs; the
+    // synonym expansion of a query is lost then
+    const PreparedQuery& RefreshIfOutdated(const PreparedQuery& prepared_query) const {
+        if (prepared_query.server_id_ != server_id_
+            || prepared_query.term_count_ != term_dictionary_.GetTermCount()
+            || prepared_query.max_prefix_expansion_ != max_prefix_expansion_) {
+            ResolvePreparedQuery(prepared_query);
+        }
+        return prepared_query;
+    }
+
+    // Returns a copy, as another search may drop the cached group once
+    // the lock is released; the merged postings are shared. A missing
+    // group is built outside the lock
+    SynonymGroup GetSynonymGroup(const string& word, const Synonyms& synonyms) const {
+        {
+            const lock_guard guard(*synonym_groups_mutex_);
+            if (synonym_groups_.synonyms_generation != synonyms.GetGeneration()
+                || synonym_groups_.index_generation != index_generation_) {
+                synonym_groups_ = {synonyms.GetGeneration(), index_generation_, {}};
+            }
+            const auto it = synonym_groups_.groups.find(word);
+            if (it != synonym_groups_.groups.end()) {
+                return it->second;
+            }
+        }
+
+        SynonymGroup group;
+        const auto add_term = [&](string_view group_word) {
+            const int term_id = term_dictionary_.Find(group_word);
+            if (term_id != TermDictionary::NO_TERM) {
+                group.term_ids.push_back(term_id);
+            }
+        };
+        add_term(word);
+        synonyms.ForEachSynonym(word, add_term);
+        sort(group.term_ids.begin(), group.term_ids.end());
+        group.term_ids.erase(unique(group.term_ids.begin(), group.term_ids.end()), group.term_ids.end());
+        if (!group.term_ids.empty()) {
+            group.postings = MergePostings(group.term_ids);
+        }
+
+        const lock_guard guard(*synonym_groups_mutex_);
+        if (synonym_groups_.synonyms_generation == synonyms.GetGeneration()
+            && synonym_groups_.index_generation == index_generation_) {
+            if (synonym_groups_.groups.size() == MAX_SYNONYM_GROUP_CACHE_SIZE) {
+                synonym_groups_.groups.clear();
+            }
+            synonym_groups_.groups.emplace(word, group);
+        }
+        return group;
+    }
+
+    shared_ptr<const map<int, double>> MergePostings(const vector<int>& term_ids) const {
+        map<int, double> postings;
+        for (const int term_id : term_ids) {
+            for (const auto& [document_id, term_freq] : *term_postings_[term_id]) {
+                postings[document_id] += term_freq;
+            }
+        }
+        return make_shared<const map<int, double>>(move(postings));
+    }
+
+    // Replaces the plus words of a freshly prepared query with the merged
+    // groups of the words and their synonyms. A term already in the
+    // group of an earlier word, or matched by a prefix, is left out of
+    // later ones, so no document counts a term twice
+    void ExpandSynonyms(PreparedQuery& query, const Synonyms& synonyms) const {
+        query.plus_terms_.clear();
+        query.merged_postings_.clear();
+        set<int> used_term_ids;
+        for (const string& word : query.query_.plus_words) {
+            if (synonyms.GetSynonymCount(word) == 0) {
+                const int term_id = term_dictionary_.Find(word);
+                if (term_id != TermDictionary::NO_TERM && used_term_ids.insert(term_id).second) {
+                    query.plus_terms_.push_back({term_id, term_postings_[term_id]});
+                }
+                continue;
+            }
+            const SynonymGroup group = GetSynonymGroup(word, synonyms);
+            vector<int> new_term_ids;
+            for (const int term_id : group.term_ids) {
+                if (used_term_ids.insert(term_id).second) {
+                    new_term_ids.push_back(term_id);
+                }
+            }
+            if (new_term_ids.empty()) {
+                continue;
+            }
+            // Groups overlap when query words are synonyms of each other
+            shared_ptr<const map<int, double>> postings = new_term_ids.size() == group.term_ids.size()
+                ? group.postings
+                : MergePostings(new_term_ids);
+            query.plus_terms_.push_back({new_term_ids.front(), postings.get()});
+            query.merged_postings_.push_back(move(postings));
+        }
+        for (const int term_id : ResolveTerms({}, query.query_.plus_prefixes, max_prefix_expansion_)) {
+            if (used_term_ids.insert(term_id).second) {
+                query.plus_terms_.push_back({term_id, term_postings_[term_id]});
+            }
+        }
+        query.is_expanded_ = true;
+    }
+
+    // A phrase runs from a word starting with a quote to a word ending
+    // with one. Its words are taken literally, without minus or star, and
+    // its stop words are dropped as they are from documents
     Query ParseQuery(const string& text) const {
         Query query;
-        for (const string& word : SplitIntoWordsNoStop(text)) {
+        for (const string& token : SplitIntoWords(text)) {
+            const bool opens_phrase = !query.has_open_phrase && token.front() == '"';
+            if (opens_phrase || query.has_open_phrase) {
+                if (opens_phrase) {
+                    query.phrases.emplace_back();
+                    query.has_open_phrase = true;
+                }
+                const size_t begin = opens_phrase ? 1 : 0;
+                const bool closes_phrase = token.size() > begin && token.back() == '"';
+                const string word = token.substr(begin, token.size() - begin - (closes_phrase ? 1 : 0));
+                if (!word.empty() && stop_words_.count(word) == 0) {
+                    query.phrases.back().push_back(word);
+                    query.plus_words.insert(word);
+                }
+                if (closes_phrase) {
+                    query.has_open_phrase = false;
+                    if (query.phrases.back().empty()) {
+                        query.phrases.pop_back();
+                    }
+                }
+                continue;
+            }
+            if (stop_words_.count(token) != 0) {
+                continue;
+            }
+            const string& word = token;
+            const bool is_prefix = !word.empty() && word.back() == '*';
             if (word.find("-"s) != -1) {
-                query.minus_words.insert(word.substr(1));
+                if (is_prefix) {
+                    query.minus_prefixes.insert(word.substr(1, word.size() - 2));
+                }
+                else {
+                    query.minus_words.insert(word.substr(1));
+                }
             }
             else {
-                query.plus_words.insert(word);
+                if (is_prefix) {
+                    query.plus_prefixes.insert(word.substr(0, word.size() - 1));
+                }
+                else {
+                    query.plus_words.insert(word);
+                }
             }
         }
 
@@ -311,6 +1549,8 @@ private:
     }       
 };
 
+using SearchServer = BasicSearchServer<TfIdfRanking>;
+
 void PrintDocument(const Document& document) {
     cout << "{ "s
     << "document_id = "s << document.id << ", "s
@@ -322,7 +1562,7 @@ void PrintDocument(const Document& document) {
 // -------- Starting Search Engine Unit Tests ----------
 
 // The test checks that the search engine excludes stop words when adding documents
-void TestExcludeStopWordsFromAddedDocumentContent() {
+TEST(TestExcludeStopWordsFromAddedDocumentContent) {
     const int doc_id = 42;
     const string content = "cat in the city"s;
     const vector<int> ratings = {1, 2, 3};
@@ -357,7 +1597,7 @@ void TestExcludeStopWordsFromAddedDocumentContent() {
     }
 }
 
-void TestMatchingDocuments() {
+TEST(TestMatchingDocuments) {
     const vector<int> doc_id = {1, 2, 0};
     // Check sort by relevance
     {
@@ -413,7 +1653,7 @@ void TestMatchingDocuments() {
     }
 }
 
-void TestCalculations() {
+TEST(TestCalculations) {
     
     const vector<vector<int>> ratings = {{5, 3, -1}, {2, 9, 0, 1}, {2, 4, 6}, {1, 2, 5}, {0, 0, -4}};
     const vector<int> mean_rating = {2, 3, 4, 2, -1};
@@ -454,17 +1694,603 @@ void TestCalculations() {
     }
 }
 
-// The entry point for running tests
-void TestSearchServer() {
-    RUN_TEST(TestExcludeStopWordsFromAddedDocumentContent);
-    RUN_TEST(TestMatchingDocuments);
-    RUN_TEST(TestCalculations);
+TEST(TestPrefixQueries) {
+    SearchServer server("и в на"s);
+    (void) server.AddDocument(0, "белый кот и модный ошейник"s,        DocumentStatus::ACTUAL, {8, -3});
+    (void) server.AddDocument(1, "пушистый котёнок пушистый хвост"s,   DocumentStatus::ACTUAL, {7, 2, 7});
+    (void) server.AddDocument(2, "ухоженный пёс выразительные глаза"s, DocumentStatus::ACTUAL, {5, -12, 2, 1});
+
+    // A prefix matches every term starting with it
+    {
+        auto found_docs = server.FindTopDocuments("кот*"s);
+        ASSERT_EQUAL(found_docs.value().size(), 2u);
+    }
+
+    // A prefix word scores the same as the words it expands to
+    {
+        auto by_prefix = server.FindTopDocuments("кот*"s).value();
+        auto by_words = server.FindTopDocuments("кот котёнок"s).value();
+        ASSERT_EQUAL(by_prefix.size(), by_words.size());
+        for (size_t i = 0; i < by_prefix.size(); ++i) {
+            ASSERT_EQUAL(by_prefix[i].id, by_words[i].id);
+            ASSERT(abs(by_prefix[i].relevance - by_words[i].relevance) < EPSILON);
+        }
+    }
+
+    // Minus prefixes exclude documents, the expansion cap bounds the terms
+    {
+        ASSERT(server.FindTopDocuments("кот* -пуш*"s).value().size() == 1);
+        ASSERT(!server.FindTopDocuments("кот* -*"s).has_value());
+        ASSERT(!server.FindTopDocuments("*"s).has_value());
+        server.SetMaxPrefixExpansion(1);
+        ASSERT(server.FindTopDocuments("кот*"s).value().size() == 1);
+        // but never minus prefixes: "пёс" sorts after "пушистый"
+        ASSERT(server.FindTopDocuments("пушистый пёс -п*"s).value().empty());
+        server.SetMaxPrefixExpansion(MAX_PREFIX_EXPANSION);
+    }
+
+    // Prefixes find terms across all sorted runs of a dictionary, in term
+    // order
+    {
+        TermDictionary dictionary;
+        for (int i = 999; i >= 0; --i) {
+            (void) dictionary.Insert("term"s + to_string(i));
+        }
+        ASSERT_EQUAL(dictionary.Find("term500"s), 499);
+        const vector<int> term_ids = dictionary.ExpandPrefix("term99"s, 20);
+        vector<string_view> terms;
+        for (const int term_id : term_ids) {
+            terms.push_back(dictionary.GetTerm(term_id));
+        }
+        ASSERT_EQUAL(terms.size(), 11u);
+        ASSERT(is_sorted(terms.begin(), terms.end()));
+        ASSERT_EQUAL(dictionary.ExpandPrefix("term"s, 5000).size(), 1000u);
+    }
+
+    // Matched words list the expanded terms
+    {
+        tuple<vector<string>, DocumentStatus> result;
+        auto [words, status] = server.MatchDocument("пуш* хвост"s, 1, result).value();
+        ASSERT(words == vector<string>({"пушистый"s, "хвост"s}));
+    }
+
+    // The dictionary takes less memory than the keys of a map of strings
+    {
+        const TermDictionary& dictionary = server.GetTermDictionary();
+        ASSERT_EQUAL(dictionary.GetTermCount(), 11u);
+        const size_t map_keys_size = dictionary.GetTermCount() * (sizeof(string) + 4 * sizeof(void*));
+        ASSERT(dictionary.GetMemoryUsage() < map_keys_size);
+    }
+}
+
+TEST(TestImpactOrderedIndex) {
+    const vector<string> texts = {
+        "белый кот и модный ошейник"s,
+        "пушистый кот пушистый хвост"s,
+        "ухоженный пёс выразительные глаза"s,
+        "кот пёс и попугай"s,
+        "большой пёс скворец"s,
+        "модный кот"s,
+        "пушистый пёс"s,
+        "ухоженный кот с модным хвостом"s,
+    };
+    SearchServer exact("и в на с"s);
+    SearchServer impact("и в на с"s);
+    for (size_t i = 0; i < texts.size(); ++i) {
+        (void) exact.AddDocument(i, texts[i], DocumentStatus::ACTUAL, {static_cast<int>(i)});
+        (void) impact.AddDocument(i, texts[i], DocumentStatus::ACTUAL, {static_cast<int>(i)});
+    }
+    impact.EnableImpactIndex(ImpactPrecision::BITS_16);
+
+    // Single- and two-term queries return the exact top documents
+    // with relevance within the reported error
+    const ImpactIndexReport report = impact.GetImpactIndexReport();
+    ASSERT_EQUAL(report.bits, 16);
+    ASSERT_EQUAL(report.stale_document_count, 0);
+    ASSERT(report.max_abs_error < 1e-4);
+    for (const string& query : {"кот"s, "пёс"s, "пушистый кот"s, "модный пёс"s, "кот -хвост"s}) {
+        const vector<Document> expected = exact.FindTopDocuments(query).value();
+        const vector<Document> found = impact.FindTopDocuments(query).value();
+        ASSERT_EQUAL_HINT(found.size(), expected.size(), query);
+        for (size_t i = 0; i < found.size(); ++i) {
+            ASSERT_EQUAL_HINT(found[i].id, expected[i].id, query);
+            ASSERT(abs(found[i].relevance - expected[i].relevance) <= 2 * report.max_abs_error + EPSILON);
+        }
+    }
+
+    // 8-bit impacts are coarser but keep the error bounded by the scale
+    impact.EnableImpactIndex(ImpactPrecision::BITS_8);
+    ASSERT(impact.GetImpactIndexReport().max_abs_error < 0.01);
+
+    // New documents are indexed with old idf values until a rebuild
+    (void) impact.AddDocument(100, "кот кот кот"s, DocumentStatus::ACTUAL, {1});
+    ASSERT_EQUAL(impact.GetImpactIndexReport().stale_document_count, 1);
+    ASSERT_EQUAL(impact.FindTopDocuments("кот"s).value()[0].id, 100);
+    impact.RebuildImpactIndex();
+    ASSERT_EQUAL(impact.GetImpactIndexReport().stale_document_count, 0);
+
+    // Documents added after enabling go through the unsorted tail and its
+    // merges, and still rank by term frequency like the exact index
+    SearchServer incremental("и в на с"s);
+    (void) incremental.AddDocument(0, "пёс"s, DocumentStatus::ACTUAL, {1});
+    (void) incremental.AddDocument(1, "кот"s, DocumentStatus::ACTUAL, {1});
+    incremental.EnableImpactIndex(ImpactPrecision::BITS_16);
+    SearchServer incremental_exact("и в на с"s);
+    (void) incremental_exact.AddDocument(0, "пёс"s, DocumentStatus::ACTUAL, {1});
+    (void) incremental_exact.AddDocument(1, "кот"s, DocumentStatus::ACTUAL, {1});
+    for (int id = 2; id < 300; ++id) {
+        string text = "кот"s;
+        for (int i = 0, filler_count = id * 37 % 300; i <= filler_count; ++i) {
+            text += " слово"s;
+        }
+        (void) incremental.AddDocument(id, text, DocumentStatus::ACTUAL, {1});
+        (void) incremental_exact.AddDocument(id, text, DocumentStatus::ACTUAL, {1});
+    }
+    const vector<Document> expected = incremental_exact.FindTopDocuments("кот"s).value();
+    const vector<Document> found = incremental.FindTopDocuments("кот"s).value();
+    ASSERT_EQUAL(found.size(), expected.size());
+    for (size_t i = 0; i < found.size(); ++i) {
+        ASSERT_EQUAL(found[i].id, expected[i].id);
+    }
+}
+
+TEST(TestPreparedQuery) {
+    SearchServer server("и в на"s);
+    (void) server.AddDocument(0, "белый кот и модный ошейник"s,        DocumentStatus::ACTUAL, {8, -3});
+    (void) server.AddDocument(1, "пушистый кот пушистый хвост"s,       DocumentStatus::ACTUAL, {7, 2, 7});
+    (void) server.AddDocument(2, "ухоженный пёс выразительные глаза"s, DocumentStatus::ACTUAL, {5, -12, 2, 1});
+
+    // A prepared query gives the same results as the raw text
+    const PreparedQuery query = server.PrepareQuery("пушистый ухоженный кот -ошейник"s);
+    ASSERT(query.IsValid());
+    for (int i = 0; i < 3; ++i) {
+        const vector<Document> expected = server.FindTopDocuments("пушистый ухоженный кот -ошейник"s).value();
+        const vector<Document> found = server.FindTopDocuments(query).value();
+        ASSERT_EQUAL(found.size(), expected.size());
+        for (size_t j = 0; j < found.size(); ++j) {
+            ASSERT_EQUAL(found[j].id, expected[j].id);
+            ASSERT(abs(found[j].relevance - expected[j].relevance) < EPSILON);
+        }
+    }
+    {
+        tuple<vector<string>, DocumentStatus> result;
+        auto [words, status] = server.MatchDocument(query, 1, result).value();
+        ASSERT(words == vector<string>({"кот"s, "пушистый"s}));
+        ASSERT(get<0>(server.MatchDocument(query, 0, result).value()).empty());
+    }
+
+    // Invalid queries stay invalid
+    const PreparedQuery invalid_query = server.PrepareQuery("кот --пёс"s);
+    ASSERT(!invalid_query.IsValid());
+    ASSERT(!server.FindTopDocuments(invalid_query).has_value());
+
+    // Terms that appear after preparation are still found
+    const PreparedQuery new_word_query = server.PrepareQuery("скворец"s);
+    ASSERT(server.FindTopDocuments(new_word_query).value().empty());
+    (void) server.AddDocument(3, "ухоженный скворец евгений"s, DocumentStatus::ACTUAL, {9});
+    ASSERT_EQUAL(server.FindTopDocuments(new_word_query).value().size(), 1u);
+
+    // A query outlives the server that prepared it and runs on another
+    // one with the same number of terms
+    optional<PreparedQuery> foreign_query;
+    {
+        SearchServer first_server;
+        (void) first_server.AddDocument(0, "кот"s, DocumentStatus::ACTUAL, {1});
+        foreign_query = first_server.PrepareQuery("кот"s);
+    }
+    BasicSearchServer<Bm25Ranking> second_server;
+    (void) second_server.AddDocument(7, "кот"s, DocumentStatus::ACTUAL, {1});
+    const vector<Document> found = second_server.FindTopDocuments(*foreign_query).value();
+    ASSERT_EQUAL(found.size(), 1u);
+    ASSERT_EQUAL(found[0].id, 7);
+}
+
+TEST(TestMemoryUsage) {
+    SearchServer server("и в на"s);
+    const MemoryUsageReport empty_report = server.GetMemoryUsage();
+    ASSERT_EQUAL(empty_report.postings, 0u);
+    ASSERT(empty_report.stop_words > 0);
+
+    (void) server.AddDocument(0, "белый кот и модный ошейник"s,        DocumentStatus::ACTUAL, {8, -3});
+    (void) server.AddDocument(1, "пушистый кот пушистый хвост"s,       DocumentStatus::ACTUAL, {7, 2, 7});
+    (void) server.AddDocument(2, "ухоженный пёс выразительные глаза"s, DocumentStatus::ACTUAL, {5, -12, 2, 1});
+    const MemoryUsageReport report = server.GetMemoryUsage();
+    ASSERT(report.postings > 0);
+    ASSERT(report.document_data > 0);
+    ASSERT(report.added_ids >= 3 * sizeof(int));
+    ASSERT_EQUAL(report.impact_index, 0u);
+    ASSERT(report.Total() > report.postings);
+
+    // Documents have 4, 3 and 4 distinct terms: one in bucket [2, 4),
+    // two in bucket [4, 8)
+    ASSERT(report.terms_per_document_histogram == vector<size_t>({0, 1, 2}));
+    // "кот" is in two documents, the other nine terms in one
+    ASSERT(report.postings_per_term_histogram == vector<size_t>({9, 1}));
+
+    server.EnableImpactIndex(ImpactPrecision::BITS_8);
+    ASSERT(server.GetMemoryUsage().impact_index > 0);
+}
+
+TEST(TestSynonymExpansion) {
+    SearchServer server("и в на"s);
+    (void) server.AddDocument(0, "кот на крыше"s, DocumentStatus::ACTUAL, {1});
+    (void) server.AddDocument(1, "кошка и мышь"s, DocumentStatus::ACTUAL, {2});
+    (void) server.AddDocument(2, "котик спит"s, DocumentStatus::ACTUAL, {3});
+    (void) server.AddDocument(3, "пёс лает"s, DocumentStatus::ACTUAL, {4});
+
+    Synonyms synonyms;
+    synonyms.Add("кот"s, "кошка"s);
+    synonyms.Add("кошка"s, "котик"s);
+    synonyms.Add("пёс"s, "собака"s);
+
+    const auto get_ids = [](const vector<Document>& documents) {
+        set<int> ids;
+        for (const Document& document : documents) {
+            ids.insert(document.id);
+        }
+        return ids;
+    };
+
+    ASSERT(get_ids(*server.FindTopDocuments("кот"s)) == set<int>({0}));
+    const vector<Document> expanded = *server.FindTopDocuments("кот"s, synonyms);
+    ASSERT(get_ids(expanded) == set<int>({0, 1}));
+    // The word and its synonym are one term: two of four documents
+    // contain it, each in half of its words
+    for (const Document& document : expanded) {
+        ASSERT(abs(document.relevance - 0.5 * log(2.0)) < EPSILON);
+    }
+
+    // A chain of pairs does not make synonyms: "котик" only through "кошка"
+    ASSERT(get_ids(*server.FindTopDocuments("котик"s, synonyms)) == set<int>({1, 2}));
+    ASSERT(get_ids(*server.FindTopDocuments("кошка"s, synonyms)) == set<int>({0, 1, 2}));
+
+    // Overlapping groups count each term once
+    const vector<Document> overlapping = *server.FindTopDocuments("кот кошка"s, synonyms);
+    ASSERT_EQUAL(overlapping.size(), 3);
+    for (const Document& document : overlapping) {
+        const double expected = document.id == 2 ? 0.5 * log(4.0) : 0.5 * log(2.0);
+        ASSERT(abs(document.relevance - expected) < EPSILON);
+    }
+    // and so does a prefix inside a group
+    const vector<Document> with_prefix = *server.FindTopDocuments("кот кот*"s, synonyms);
+    ASSERT_EQUAL(with_prefix.size(), 3);
+    for (const Document& document : with_prefix) {
+        ASSERT(abs(document.relevance - (document.id == 2 ? 0.5 * log(4.0) : 0.5 * log(2.0))) < EPSILON);
+    }
+
+    // Minus words are not expanded, words without synonyms match as usual
+    ASSERT(get_ids(*server.FindTopDocuments("кошка -кот"s, synonyms)) == set<int>({1, 2}));
+    ASSERT(get_ids(*server.FindTopDocuments("спит"s, synonyms)) == set<int>({2}));
+    ASSERT(get_ids(*server.FindTopDocuments("собака"s, synonyms)) == set<int>({3}));
+    ASSERT(server.FindTopDocuments("кот --"s, synonyms) == nullopt);
+
+    // Concurrent searches share the group cache
+    {
+        const vector<string> queries = {"кот"s, "котик"s, "кошка"s, "собака"s, "кот кошка"s, "пёс -кот"s};
+        vector<set<int>> expected_ids;
+        for (const string& query : queries) {
+            expected_ids.push_back(get_ids(*server.FindTopDocuments(query, synonyms)));
+        }
+        vector<int> runs(1000);
+        iota(runs.begin(), runs.end(), 0);
+        ASSERT(all_of(execution::par, runs.begin(), runs.end(), [&](int run) {
+            const size_t index = run % queries.size();
+            return get_ids(*server.FindTopDocuments(queries[index], synonyms)) == expected_ids[index];
+        }));
+    }
+
+    // New documents and new pairs reach cached groups
+    (void) server.AddDocument(4, "кошка кошка"s, DocumentStatus::ACTUAL, {5});
+    ASSERT(get_ids(*server.FindTopDocuments("котик"s, synonyms)) == set<int>({1, 2, 4}));
+    synonyms.Add("лает"s, "кот"s);
+    ASSERT(get_ids(*server.FindTopDocuments("кот"s, synonyms)) == set<int>({0, 1, 3, 4}));
+
+    // The impact index serves single terms only, not merged groups
+    server.EnableImpactIndex(ImpactPrecision::BITS_16);
+    ASSERT_EQUAL(server.FindTopDocuments("кошка"s, synonyms)->size(), 4);
+    ASSERT_EQUAL(server.FindTopDocuments("кошка"s)->size(), 2);
+}
+
+TEST(TestPhraseQueries) {
+    const auto get_ids = [](const optional<vector<Document>>& documents) {
+        set<int> ids;
+        for (const Document& document : documents.value()) {
+            ids.insert(document.id);
+        }
+        return ids;
+    };
+    SearchServer server("и в на"s);
+    server.EnablePositionalIndex();
+    (void) server.AddDocument(5, "пушистый кот и пушистый хвост"s, DocumentStatus::ACTUAL, {1});
+    (void) server.AddDocument(1, "кот пушистый"s, DocumentStatus::ACTUAL, {2});
+    (void) server.AddDocument(3, "белый пушистый кот в шляпе"s, DocumentStatus::ACTUAL, {3});
+    (void) server.AddDocument(2, "пушистый белый кот"s, DocumentStatus::ACTUAL, {4});
+
+    // Phrase words must be adjacent and in order
+    ASSERT_EQUAL(get_ids(server.FindTopDocuments("\"пушистый кот\""s)), set<int>({3, 5}));
+    ASSERT_EQUAL(get_ids(server.FindTopDocuments("\"пушистый\" хвост"s)), set<int>({1, 2, 3, 5}));
+    // Stop words are skipped in documents and phrases alike
+    ASSERT_EQUAL(get_ids(server.FindTopDocuments("\"кот и пушистый\""s)), set<int>({1, 5}));
+    // Phrases combine with each other and with minus words
+    ASSERT_EQUAL(get_ids(server.FindTopDocuments("\"пушистый кот\" -шляпе"s)), set<int>({5}));
+    ASSERT_EQUAL(get_ids(server.FindTopDocuments("\"пушистый кот\" \"пушистый хвост\""s)), set<int>({5}));
+    ASSERT(server.FindTopDocuments("\"пушистый пёс\""s)->empty());
+    ASSERT(!server.FindTopDocuments("\"пушистый кот"s).has_value());
+
+    // All words count for relevance, but only documents with the phrase match
+    const auto by_phrase = server.FindTopDocuments("\"белый пушистый\" кот"s).value();
+    ASSERT_EQUAL(by_phrase.size(), 1u);
+    ASSERT_EQUAL(by_phrase[0].id, 3);
+
+    tuple<vector<string>, DocumentStatus> result;
+    const auto matched = server.MatchDocument("\"пушистый кот\""s, 3, result);
+    ASSERT_EQUAL(get<0>(*matched), vector<string>({"кот"s, "пушистый"s}));
+    ASSERT(get<0>(*server.MatchDocument("\"пушистый кот\""s, 1, result)).empty());
+
+    // Ids out of order and gaps above 127 positions
+    string long_text = "кот"s;
+    for (int i = 0; i < 200; ++i) {
+        long_text += " слово"s + to_string(i);
+    }
+    (void) server.AddDocument(0, long_text + " пушистый кот"s, DocumentStatus::ACTUAL, {5});
+    ASSERT_EQUAL(get_ids(server.FindTopDocuments("\"пушистый кот\""s)), set<int>({0, 3, 5}));
+    ASSERT_EQUAL(get_ids(server.FindTopDocuments("\"слово199 пушистый кот\""s)), set<int>({0}));
+
+    // Without positions a phrase cannot be answered
+    SearchServer plain_server("и в на"s);
+    (void) plain_server.AddDocument(0, "пушистый кот"s, DocumentStatus::ACTUAL, {1});
+    ASSERT(!plain_server.FindTopDocuments("\"пушистый кот\""s).has_value());
+    ASSERT(plain_server.FindTopDocuments("пушистый кот"s).has_value());
+    ASSERT(server.GetMemoryUsage().positional_index > 0);
+    ASSERT_EQUAL(plain_server.GetMemoryUsage().positional_index, 0u);
+}
+
+TEST(TestResultCursor) {
+    const auto get_ids = [](const vector<Document>& documents) {
+        vector<int> ids;
+        for (const Document& document : documents) {
+            ids.push_back(document.id);
+        }
+        return ids;
+    };
+    // The more tails, the lower the relevance of "кот"
+    SearchServer server("и в на"s);
+    for (int id = 0; id < 10; ++id) {
+        string text = "кот"s;
+        for (int i = 0; i < id; ++i) {
+            text += " хвост"s;
+        }
+        (void) server.AddDocument(id, text, id == 9 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL, {id});
+    }
+    (void) server.AddDocument(10, "пёс"s, DocumentStatus::ACTUAL, {0});
+
+    auto cursor = server.OpenCursor("кот -лапа"s);
+    ASSERT_EQUAL(cursor->GetRemainingCount(), 9u);
+    const vector<Document> first_page = server.NextPage(*cursor, MAX_RESULT_DOCUMENT_COUNT).value();
+    ASSERT_EQUAL(get_ids(first_page), get_ids(*server.FindTopDocuments("кот -лапа"s)));
+    ASSERT_EQUAL(get_ids(*server.NextPage(*cursor, 3)), vector<int>({5, 6, 7}));
+    ASSERT_EQUAL(get_ids(*server.NextPage(*cursor, 3)), vector<int>({8}));
+    ASSERT(server.NextPage(*cursor, 3)->empty());
+
+    auto banned = server.OpenCursor("кот"s, DocumentStatus::BANNED);
+    ASSERT_EQUAL(get_ids(*server.NextPage(*banned, 10)), vector<int>({9}));
+    ASSERT(!server.OpenCursor("кот --лапа"s).has_value());
+
+    // Any new document makes open cursors stale
+    auto stale = server.OpenCursor("кот"s);
+    const uint64_t generation = server.GetIndexGeneration();
+    (void) server.AddDocument(11, "кот кот"s, DocumentStatus::ACTUAL, {1});
+    ASSERT(server.GetIndexGeneration() != generation);
+    ASSERT(!server.NextPage(*stale, 1).has_value());
+    auto reopened = server.OpenCursor("кот"s);
+    ASSERT_EQUAL(get_ids(*server.NextPage(*reopened, 1)), vector<int>({11}));
+
+    // A cursor belongs to the server that opened it
+    SearchServer other_server("и в на"s);
+    ASSERT(!other_server.NextPage(*reopened, 1).has_value());
+}
+
+TEST(TestRankingPolicies) {
+    const auto add_documents = [](auto& server) {
+        (void) server.AddDocument(0, "кот"s, DocumentStatus::ACTUAL, {1});
+        (void) server.AddDocument(1, "кот хвост хвост хвост"s, DocumentStatus::ACTUAL, {2});
+        (void) server.AddDocument(2, "пёс"s, DocumentStatus::ACTUAL, {3});
+    };
+
+    // TF-IDF stays the default
+    SearchServer tf_idf_server("и в на"s);
+    add_documents(tf_idf_server);
+    const vector<Document> tf_idf_found = tf_idf_server.FindTopDocuments("кот"s).value();
+    ASSERT_EQUAL(tf_idf_found.size(), 2u);
+    ASSERT(abs(tf_idf_found[0].relevance - log(1.5)) < EPSILON);
+    ASSERT(abs(tf_idf_found[1].relevance - 0.25 * log(1.5)) < EPSILON);
+
+    // Average length is 2, so the one-word document weighs more than the
+    // four-word one by its length alone
+    BasicSearchServer<Bm25Ranking> bm25_server("и в на"s);
+    add_documents(bm25_server);
+    const double inverse_document_freq = log(1.0 + 1.5 / 2.5);
+    const auto bm25 = [](double term_count, double length) {
+        return term_count * 2.2 / (term_count + 1.2 * (0.25 + 0.75 * length / 2.0));
+    };
+    const vector<Document> bm25_found = bm25_server.FindTopDocuments("кот"s).value();
+    ASSERT_EQUAL(bm25_found.size(), 2u);
+    ASSERT_EQUAL(bm25_found[0].id, 0);
+    ASSERT(abs(bm25_found[0].relevance - inverse_document_freq * bm25(1, 1)) < EPSILON);
+    ASSERT(abs(bm25_found[1].relevance - inverse_document_freq * bm25(1, 4)) < EPSILON);
+
+    // Counts saturate: three tails score far less than three times one
+    const double tail_relevance = bm25_server.FindTopDocuments("хвост"s).value()[0].relevance;
+    ASSERT(abs(tail_relevance - log(1.0 + 2.5 / 1.5) * bm25(3, 4)) < EPSILON);
+
+    // The impact index quantizes the scores of the policy
+    bm25_server.EnableImpactIndex(ImpactPrecision::BITS_16);
+    ASSERT(bm25_server.GetImpactIndexReport().max_abs_error < 1e-3);
+    ASSERT_EQUAL(bm25_server.FindTopDocuments("кот"s).value()[0].id, 0);
+}
+
+// Container output is what failed assertions print, so it is checked here
+TEST(TestContainerOutput) {
+    const auto print = [](const auto& value) {
+        ostringstream out;
+        out << value;
+        return out.str();
+    };
+    ASSERT_EQUAL(print(vector<int>{}), "[]"s);
+    ASSERT_EQUAL(print(vector<double>{0.5, 1.0 / 3, 1e20}), "[0.5, 0.333333, 1e+20]"s);
+    ASSERT_EQUAL(print(set<string>{"кот"s, "пёс"s}), "{кот, пёс}"s);
+    ASSERT_EQUAL(print(map<string, vector<int>>{{"a"s, {1, 2}}, {"b"s, {}}}), "{a: [1, 2], b: []}"s);
+    ASSERT_EQUAL(print(unordered_map<int, string>{{7, "x"s}}), "{7: x}"s);
+    ASSERT_EQUAL(print(vector<pair<int, double>>{{1, 0.25}}), "[(1, 0.25)]"s);
+    ASSERT_EQUAL(print(tuple{1, "a"s, vector<char>{'b'}}), "(1, a, [b])"s);
+
+    // Stream state still applies, as it did element by element
+    ostringstream out;
+    out << boolalpha << setprecision(2) << hex << vector<bool>{true} << vector<double>{3.14159} << vector<int>{255};
+    ASSERT_EQUAL(out.str(), "[true][3.1][ff]"s);
+}
+
+// The entry point for running tests: every TEST above, each in a
+// process of its own
+void TestSearchServer(const TestRunOptions& options = {}) {
+    if (RunRegisteredTests(options) > 0) {
+        abort();
+    }
 }
 
 // --------- End of search engine unit tests -----------
 
+// Query latency on a generated collection of document_count documents
+// of 20 words each
+void BenchmarkSearchServer(int document_count) {
+    mt19937 generator(42);
+    const int word_count = 5000;
+    SearchServer server("и в на"s);
+    for (int id = 0; id < document_count; ++id) {
+        string text;
+        for (int i = 0; i < 20; ++i) {
+            text += "word"s + to_string(generator() % word_count) + " "s;
+        }
+        (void) server.AddDocument(id, text, DocumentStatus::ACTUAL, {static_cast<int>(generator() % 10)});
+    }
+
+    const string query = "word1 word22 word333 word4444 -word5"s;
+    const string prefix_query = "word12* word7"s;
+    const PreparedQuery prepared = server.PrepareQuery(query);
+    BENCHMARK_ARGS(server.FindTopDocuments, query);
+    BENCHMARK_ARGS(server.FindTopDocuments, prepared);
+    BENCHMARK_ARGS(server.FindTopDocuments, prefix_query);
+    server.EnableImpactIndex(ImpactPrecision::BITS_8);
+    BENCHMARK_ARGS(server.FindTopDocuments, server.PrepareQuery("word1 word22 word333 word4444"s));
+}
+
+// The same queries ranked by TF-IDF and by BM25, which also looks up
+// the length of every matched document
+void BenchmarkRankingPolicies(int document_count) {
+    mt19937 generator(42);
+    const int word_count = 5000;
+    SearchServer tf_idf_server("и в на"s);
+    BasicSearchServer<Bm25Ranking> bm25_server("и в на"s);
+    for (int id = 0; id < document_count; ++id) {
+        string text;
+        for (int i = 0, length = 5 + generator() % 30; i < length; ++i) {
+            text += "word"s + to_string(generator() % word_count) + " "s;
+        }
+        const int rating = generator() % 10;
+        (void) tf_idf_server.AddDocument(id, text, DocumentStatus::ACTUAL, {rating});
+        (void) bm25_server.AddDocument(id, text, DocumentStatus::ACTUAL, {rating});
+    }
+
+    const string query = "word1 word22 word333 word4444 -word5"s;
+    const PreparedQuery tf_idf_query = tf_idf_server.PrepareQuery(query);
+    const PreparedQuery bm25_query = bm25_server.PrepareQuery(query);
+    BENCHMARK_ARGS(tf_idf_server.FindTopDocuments, tf_idf_query);
+    BENCHMARK_ARGS(bm25_server.FindTopDocuments, bm25_query);
+    cout << "Document data: TF-IDF "s << tf_idf_server.GetMemoryUsage().document_data
+         << " bytes, BM25 "s << bm25_server.GetMemoryUsage().document_data << " bytes"s << endl;
+}
+
+// Reading the first page_count pages of page_size results through one
+// cursor against scoring the query again for every page
+void BenchmarkResultPages(int document_count, int page_count, size_t page_size) {
+    mt19937 generator(42);
+    const int word_count = 1000;
+    SearchServer server("и в на"s);
+    for (int id = 0; id < document_count; ++id) {
+        string text;
+        for (int i = 0; i < 20; ++i) {
+            text += "word"s + to_string(generator() % word_count) + " "s;
+        }
+        (void) server.AddDocument(id, text, DocumentStatus::ACTUAL, {static_cast<int>(generator() % 10)});
+    }
+
+    const string query = "word1 word2 word3 word4 word5"s;
+    const auto page_with_cursor = [&server, &query, page_count, page_size] {
+        ResultCursor cursor = *server.OpenCursor(query);
+        vector<Document> page;
+        for (int i = 0; i < page_count; ++i) {
+            page = *server.NextPage(cursor, page_size);
+        }
+        return page;
+    };
+    const auto page_by_requery = [&server, &query, page_count, page_size] {
+        vector<Document> page;
+        for (int i = 0; i < page_count; ++i) {
+            ResultCursor cursor = *server.OpenCursor(query);
+            (void) server.NextPage(cursor, i * page_size);
+            page = *server.NextPage(cursor, page_size);
+        }
+        return page;
+    };
+    BENCHMARK(page_with_cursor);
+    BENCHMARK(page_by_requery);
+}
+
+// A phrase query over the positional index against checking the text of
+// every document that has all the words
+void BenchmarkPhraseQueries(int document_count) {
+    mt19937 generator(42);
+    const int word_count = 500;
+    SearchServer server("и в на"s);
+    server.EnablePositionalIndex();
+    vector<string> texts;
+    for (int id = 0; id < document_count; ++id) {
+        string text;
+        for (int i = 0; i < 20; ++i) {
+            text += "word"s + to_string(generator() % word_count) + " "s;
+        }
+        (void) server.AddDocument(id, text, DocumentStatus::ACTUAL, {static_cast<int>(generator() % 10)});
+        texts.push_back(move(text));
+    }
+
+    BENCHMARK_ARGS(server.FindTopDocuments, "\"word1 word2\""s);
+    const auto match_and_scan_texts = [&server, &texts] {
+        tuple<vector<string>, DocumentStatus> result;
+        const PreparedQuery query = server.PrepareQuery("word1 word2"s);
+        vector<int> document_ids;
+        for (int id = 0; id < static_cast<int>(texts.size()); ++id) {
+            if (get<0>(*server.MatchDocument(query, id, result)).size() == 2
+                && texts[id].find("word1 word2 "s) != string::npos) {
+                document_ids.push_back(id);
+            }
+        }
+        return document_ids;
+    };
+    BENCHMARK(match_and_scan_texts);
+    const MemoryUsageReport report = server.GetMemoryUsage();
+    cout << "Positional index: "s << report.positional_index << " bytes, postings: "s << report.postings << " bytes"s << endl;
+}
+
 // int main() {
-//     RUN_TEST(TestSearchServer);
+//     GetBenchmarkOptions().json_output = &cout;
+//     BenchmarkSearchServer(100'000);
+//     BenchmarkPhraseQueries(100'000);
+//     BenchmarkResultPages(100'000, 20, 10);
+//     BenchmarkRankingPolicies(100'000);
+// }
+
+// int main(int argc, char* argv[]) {
+//     TestSearchServer(ParseTestRunOptions(argc, argv));
 
 //     vector<string> stop_words = {"и"s, "в"s, "на"s};
 //     // SearchServer search_server("и в на"s);
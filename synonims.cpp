@@ -1,43 +1,214 @@
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <execution>
+#include <fstream>
 #include <iostream>
+#include <malloc.h>
 #include <map>
+#include <numeric>
+#include <random>
 #include <set>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "synonyms-lib.cpp"
 #include "unit-tests-lib.cpp"
 
 using namespace std;
 
-class Synonyms {
-public:
-    void Add(const string& first_word, const string& second_word) {
-        synonyms_[first_word].insert(second_word);
-        synonyms_[second_word].insert(first_word);
-    }
+// Answers commands one line at a time, flushing every answer, so the
+// dictionary can be used interactively
+void RunCommandLoop(istream& input, Synonyms& synonyms, ostream& output) {
+    string line;
+    while (getline(input, line)) {
+        istringstream command(line);
+        string action;
+        command >> action;
 
-    size_t GetSynonymCount(const string& word) const {
-        if (synonyms_.count(word) != 0) {
-            return synonyms_.at(word).size();
+        if (action == "ADD"s) {
+            string first_word, second_word;
+            command >> first_word >> second_word;
+            synonyms.Add(first_word, second_word);
+        } else if (action == "COUNT"s) {
+            string word;
+            command >> word;
+            output << synonyms.GetSynonymCount(word) << endl;
+        } else if (action == "CHECK"s) {
+            string first_word, second_word;
+            command >> first_word >> second_word;
+            if (synonyms.AreSynonyms(first_word, second_word)) {
+                output << "YES"s << endl;
+            } else {
+                output << "NO"s << endl;
+            }
+        } else if (action == "SAME_CLASS"s) {
+            string first_word, second_word;
+            command >> first_word >> second_word;
+            if (synonyms.AreInSameClass(first_word, second_word)) {
+                output << "YES"s << endl;
+            } else {
+                output << "NO"s << endl;
+            }
+        } else if (action == "CLASS_SIZE"s) {
+            string word;
+            command >> word;
+            output << synonyms.GetClassSize(word) << endl;
+        } else if (action == "LOAD"s) {
+            string path;
+            command >> path;
+            ifstream pairs(path);
+            output << synonyms.LoadPairs(pairs) << endl;
+        } else if (action == "EXIT"s) {
+            break;
         }
-        return 0;
     }
+}
 
-    bool AreSynonyms(const string& first_word, const string& second_word) const {
-        if (synonyms_.count(first_word) != 0) {
-            if (synonyms_.at(first_word).count(second_word) != 0) {
-                return true;
+// An action and the first two words after it on a command line.
+// Missing words are empty, as the loop above leaves them
+struct Command {
+    string_view action;
+    string_view first_word;
+    string_view second_word;
+};
+
+// Splits off the next whitespace-separated word of line
+string_view ReadWord(string_view& line) {
+    size_t begin = 0;
+    while (begin < line.size() && isspace(static_cast<unsigned char>(line[begin]))) {
+        ++begin;
+    }
+    size_t end = begin;
+    while (end < line.size() && !isspace(static_cast<unsigned char>(line[end]))) {
+        ++end;
+    }
+    const string_view word = line.substr(begin, end - begin);
+    line.remove_prefix(end);
+    return word;
+}
+
+Command ParseCommand(string_view line) {
+    Command command;
+    command.action = ReadWord(line);
+    command.first_word = ReadWord(line);
+    command.second_word = ReadWord(line);
+    return command;
+}
+
+// COUNT and CHECK only read the dictionary, so runs of them may be
+// answered on several threads. SAME_CLASS and CLASS_SIZE compress class
+// paths as they go and are answered one at a time like the writes
+bool IsParallelCommand(const Command& command) {
+    return command.action == "COUNT"sv || command.action == "CHECK"sv;
+}
+
+void AnswerParallelCommand(const Synonyms& synonyms, const Command& command, string& output) {
+    if (command.action == "COUNT"sv) {
+        output += to_string(synonyms.GetSynonymCount(command.first_word));
+    } else {
+        output += synonyms.AreSynonyms(command.first_word, command.second_word) ? "YES"sv : "NO"sv;
+    }
+    output += '\n';
+}
+
+void AnswerCommand(Synonyms& synonyms, const Command& command, string& output) {
+    if (command.action == "ADD"sv) {
+        synonyms.Add(command.first_word, command.second_word);
+    } else if (command.action == "SAME_CLASS"sv) {
+        output += synonyms.AreInSameClass(command.first_word, command.second_word) ? "YES\n"sv : "NO\n"sv;
+    } else if (command.action == "CLASS_SIZE"sv) {
+        output += to_string(synonyms.GetClassSize(command.first_word));
+        output += '\n';
+    } else if (command.action == "LOAD"sv) {
+        ifstream pairs{string(command.first_word)};
+        output += to_string(synonyms.LoadPairs(pairs));
+        output += '\n';
+    }
+}
+
+// Read commands are collected into runs of at most MAX_PARALLEL_RUN;
+// a run is split into chunks of PARALLEL_CHUNK_SIZE answered in
+// parallel, and runs of a single chunk are answered in place
+const size_t MAX_PARALLEL_RUN = 1 << 16;
+const size_t PARALLEL_CHUNK_SIZE = 4096;
+const size_t OUTPUT_BUFFER_SIZE = 1 << 16;
+
+// Answers every command of input up to EXIT with the same output as
+// RunCommandLoop. Writes act as barriers: the read commands between two
+// of them see one unchanging dictionary, and their answers are joined
+// in input order into one buffer written in large blocks
+void ProcessCommands(string_view input, Synonyms& synonyms, ostream& output) {
+    string buffer;
+    vector<Command> run;
+    vector<string> chunk_outputs;
+
+    const auto answer_run = [&] {
+        if (run.size() <= PARALLEL_CHUNK_SIZE) {
+            for (const Command& command : run) {
+                AnswerParallelCommand(synonyms, command, buffer);
             }
-            else {
-                return false;
+        } else {
+            const size_t chunk_count = (run.size() + PARALLEL_CHUNK_SIZE - 1) / PARALLEL_CHUNK_SIZE;
+            chunk_outputs.resize(chunk_count);
+            vector<size_t> chunks(chunk_count);
+            iota(chunks.begin(), chunks.end(), 0);
+            for_each(execution::par, chunks.begin(), chunks.end(), [&](size_t chunk) {
+                string& chunk_output = chunk_outputs[chunk];
+                chunk_output.clear();
+                const size_t end = min(run.size(), (chunk + 1) * PARALLEL_CHUNK_SIZE);
+                for (size_t i = chunk * PARALLEL_CHUNK_SIZE; i < end; ++i) {
+                    AnswerParallelCommand(synonyms, run[i], chunk_output);
+                }
+            });
+            for (const string& chunk_output : chunk_outputs) {
+                buffer += chunk_output;
             }
-        } 
-        else {
-            return false;
+        }
+        run.clear();
+    };
+    const auto flush = [&] {
+        output.write(buffer.data(), buffer.size());
+        buffer.clear();
+    };
+
+    while (!input.empty()) {
+        const size_t line_end = min(input.find('\n'), input.size());
+        const Command command = ParseCommand(input.substr(0, line_end));
+        input.remove_prefix(min(line_end + 1, input.size()));
+
+        if (IsParallelCommand(command)) {
+            run.push_back(command);
+            if (run.size() == MAX_PARALLEL_RUN) {
+                answer_run();
+            }
+        } else {
+            answer_run();
+            if (command.action == "EXIT"sv) {
+                break;
+            }
+            AnswerCommand(synonyms, command, buffer);
+        }
+        if (buffer.size() >= OUTPUT_BUFFER_SIZE) {
+            flush();
         }
     }
+    answer_run();
+    flush();
+}
 
-private:
-    map<string, set<string>> synonyms_;
-};
+string ReadAll(FILE* file) {
+    string text;
+    char chunk[1 << 16];
+    size_t read_size;
+    while ((read_size = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        text.append(chunk, read_size);
+    }
+    return text;
+}
 
 void TestAddingSynonymsIncreasesTheirCount() {
     Synonyms synonyms;
@@ -70,41 +241,293 @@ void TestAreSynonyms() {
     cout << "Test AreSynonyms passed!"s << endl;
 }
 
+void TestSynonymClasses() {
+    Synonyms synonyms;
+    synonyms.Add("music"s, "melody"s);
+    synonyms.Add("melody"s, "tune"s);
+    synonyms.Add("dance"s, "ballet"s);
+
+    // Only direct pairs are synonyms, but the whole chain is one class
+    ASSERT(synonyms.AreSynonyms("music"s, "tune"s) == false);
+    ASSERT(synonyms.AreInSameClass("music"s, "tune"s) == true);
+    ASSERT(synonyms.AreInSameClass("tune"s, "music"s) == true);
+    ASSERT(synonyms.AreInSameClass("music"s, "dance"s) == false);
+    ASSERT(synonyms.AreInSameClass("music"s, "noise"s) == false);
+    ASSERT(synonyms.AreInSameClass("noise"s, "noise"s) == true);
+    ASSERT_EQUAL(synonyms.GetClassSize("melody"s), 3);
+    ASSERT_EQUAL(synonyms.GetClassSize("ballet"s), 2);
+    ASSERT_EQUAL(synonyms.GetClassSize("noise"s), 1);
+
+    // Joining two classes, and repeating a pair, counts every word once
+    synonyms.Add("tune"s, "dance"s);
+    synonyms.Add("music"s, "melody"s);
+    ASSERT(synonyms.AreInSameClass("music"s, "ballet"s) == true);
+    ASSERT_EQUAL(synonyms.GetClassSize("music"s), 5);
+    ASSERT_EQUAL(synonyms.GetSynonymCount("music"s), 1);
+
+    istringstream pairs("a b\nc d\n\nb  c\ne f"s);
+    Synonyms loaded;
+    ASSERT_EQUAL(loaded.LoadPairs(pairs), 4);
+    ASSERT(loaded.AreSynonyms("b"s, "c"s) == true);
+    ASSERT(loaded.AreInSameClass("a"s, "d"s) == true);
+    ASSERT(loaded.AreInSameClass("a"s, "e"s) == false);
+    ASSERT_EQUAL(loaded.GetClassSize("d"s), 4);
+
+    // Class words and ids follow the unions; every new pair changes the generation
+    set<string> class_words;
+    loaded.ForEachWordInClass("c"s, [&class_words](string_view word) { class_words.emplace(word); });
+    ASSERT(class_words == set<string>({"a"s, "b"s, "c"s, "d"s}));
+    ASSERT_EQUAL(loaded.GetClassId("a"s), loaded.GetClassId("d"s));
+    ASSERT(loaded.GetClassId("a"s) != loaded.GetClassId("e"s));
+    ASSERT_EQUAL(loaded.GetClassId("z"s), Synonyms::NO_CLASS);
+    const uint64_t generation = loaded.GetGeneration();
+    loaded.Add("a"s, "b"s);
+    ASSERT_EQUAL(loaded.GetGeneration(), generation);
+    loaded.Add("f"s, "a"s);
+    ASSERT(loaded.GetGeneration() != generation);
+    ASSERT(loaded.GetGeneration() != synonyms.GetGeneration());
+    class_words.clear();
+    loaded.ForEachWordInClass("e"s, [&class_words](string_view word) { class_words.emplace(word); });
+    ASSERT_EQUAL(class_words.size(), 6);
+    class_words.clear();
+    loaded.ForEachWordInClass("z"s, [&class_words](string_view word) { class_words.emplace(word); });
+    ASSERT(class_words == set<string>({"z"s}));
+
+    // Direct synonyms are the pairs of the word alone, not its class
+    vector<string> synonym_words;
+    loaded.ForEachSynonym("b"s, [&synonym_words](string_view word) { synonym_words.emplace_back(word); });
+    ASSERT(synonym_words == vector<string>({"c"s, "a"s}));
+    synonym_words.clear();
+    loaded.ForEachSynonym("z"s, [&synonym_words](string_view word) { synonym_words.emplace_back(word); });
+    ASSERT(synonym_words.empty());
+
+    // A long chain stays consistent through rank union and path compression
+    Synonyms chain;
+    const int word_count = 10000;
+    for (int i = 1; i < word_count; ++i) {
+        chain.Add(to_string(i - 1), to_string(i));
+    }
+    ASSERT(chain.AreInSameClass("0"s, to_string(word_count - 1)) == true);
+    ASSERT_EQUAL(chain.GetClassSize("5000"s), word_count);
+    cout << "Test SynonymClasses passed!"s << endl;
+}
+
+void TestManySynonyms() {
+    Synonyms synonyms;
+    const int word_count = 5000;
+    // Every word is a synonym of the next three, so the tables grow many times
+    for (int i = 0; i < word_count; ++i) {
+        for (int j = 1; j <= 3; ++j) {
+            synonyms.Add("w"s + to_string(i), "w"s + to_string((i + j) % word_count));
+        }
+    }
+    // Pairs are unordered and a word may be its own synonym
+    synonyms.Add("w1"s, "w0"s);
+    synonyms.Add("self"s, "self"s);
+    synonyms.Add("self"s, "self"s);
+
+    for (int i = 0; i < word_count; ++i) {
+        const string word = "w"s + to_string(i);
+        ASSERT_EQUAL(synonyms.GetSynonymCount(word), 6);
+        ASSERT(synonyms.AreSynonyms(word, "w"s + to_string((i + 3) % word_count)) == true);
+        ASSERT(synonyms.AreSynonyms("w"s + to_string((i + 2) % word_count), word) == true);
+        ASSERT(synonyms.AreSynonyms(word, "w"s + to_string((i + 4) % word_count)) == false);
+    }
+    ASSERT_EQUAL(synonyms.GetSynonymCount("self"s), 1);
+    ASSERT(synonyms.AreSynonyms("self"s, "self"s) == true);
+    ASSERT(synonyms.AreSynonyms("w0"s, "w"s) == false);
+    ASSERT_EQUAL(synonyms.GetSynonymCount("w"s), 0);
+    cout << "Test ManySynonyms passed!"s << endl;
+}
+
+void TestBatchCommands() {
+    // Odd spacing, missing and extra words, CRLF, unknown and empty
+    // lines, and commands after EXIT
+    string input = "ADD a b\nCOUNT a\nCHECK  b\ta\r\nCHECK a c\nADD c\nCOUNT c\nCOUNT\nCHECK c\n"s
+                   "FOO a b\n\n  ADD  b   c extra\nSAME_CLASS a c\nCLASS_SIZE c\nCOUNT b\n"s;
+    mt19937 generator(3);
+    for (int i = 0; i < 50000; ++i) {
+        const int kind = generator() % 100;
+        const string first_word = to_string(generator() % 500);
+        const string second_word = to_string(generator() % 500);
+        if (kind < 2) {
+            input += "ADD "s + first_word + " "s + second_word + "\n"s;
+        } else if (kind < 3) {
+            input += "SAME_CLASS "s + first_word + " "s + second_word + "\n"s;
+        } else if (kind < 50) {
+            input += "COUNT "s + first_word + "\n"s;
+        } else {
+            input += "CHECK "s + first_word + " "s + second_word + "\n"s;
+        }
+    }
+    // A long run of reads with no write between them
+    for (int i = 0; i < 20000; ++i) {
+        input += "CHECK "s + to_string(generator() % 500) + " "s + to_string(generator() % 500) + "\n"s;
+    }
+    input += "EXIT\nCOUNT a\n"s;
+
+    istringstream line_input(input);
+    ostringstream line_output;
+    Synonyms line_synonyms;
+    RunCommandLoop(line_input, line_synonyms, line_output);
+
+    ostringstream batch_output;
+    Synonyms batch_synonyms;
+    ProcessCommands(input, batch_synonyms, batch_output);
+    ASSERT(batch_output.str() == line_output.str());
+    // A missing word is the empty word, so "ADD c" pairs c with it
+    const string expected_start = "1\nYES\nNO\n1\n1\nYES\nYES\n4\n2\n"s;
+    ASSERT(batch_output.str().substr(0, expected_start.size()) == expected_start);
+    cout << "Test BatchCommands passed!"s << endl;
+}
+
 void TestSynonyms() {
     TestAddingSynonymsIncreasesTheirCount();
     TestAreSynonyms();
+    TestSynonymClasses();
+    TestManySynonyms();
+    TestBatchCommands();
     cout << "Test Synonyms passed!"s << endl;
 }
 
-int main() {
-    TestSynonyms();
+// The synonym dictionary as it was kept before WordTable and WordPairSet
+class MapSynonyms {
+public:
+    void Add(const string& first_word, const string& second_word) {
+        synonyms_[first_word].insert(second_word);
+        synonyms_[second_word].insert(first_word);
+    }
 
-    Synonyms synonyms;
+    bool AreSynonyms(const string& first_word, const string& second_word) const {
+        const auto it = synonyms_.find(first_word);
+        return it != synonyms_.end() && it->second.count(second_word) != 0;
+    }
 
-    string line;
-    while (getline(cin, line)) {
-        istringstream command(line);
-        string action;
-        command >> action;
+private:
+    map<string, set<string>> synonyms_;
+};
 
-        if (action == "ADD"s) {
-            string first_word, second_word;
-            command >> first_word >> second_word;
-            synonyms.Add(first_word, second_word);
-        } else if (action == "COUNT"s) {
-            string word;
-            command >> word;
-            cout << synonyms.GetSynonymCount(word) << endl;
-        } else if (action == "CHECK"s) {
-            string first_word, second_word;
-            command >> first_word >> second_word;
-            if (synonyms.AreSynonyms(first_word, second_word)) {
-                cout << "YES"s << endl;
-            } else {
-                cout << "NO"s << endl;
-            }
-        } else if (action == "EXIT"s) {
-            break;
+// Heap bytes in use, as malloc counts them
+size_t GetHeapUsage() {
+    const struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+// Builds a dictionary of pair_count random pairs over pair_count / 2
+// words and checks as many pairs, half of them present. Prints the heap
+// growth and the throughput of both steps
+template <typename Dictionary>
+void BenchmarkDictionary(const string& name, const vector<pair<string, string>>& pairs) {
+    const size_t heap_before = GetHeapUsage();
+    const auto start = chrono::steady_clock::now();
+    Dictionary dictionary;
+    for (const auto& [first_word, second_word]: pairs) {
+        dictionary.Add(first_word, second_word);
+    }
+    const auto built = chrono::steady_clock::now();
+    size_t found_count = 0;
+    for (size_t i = 0; i < pairs.size(); ++i) {
+        const auto& [first_word, second_word] = pairs[i];
+        found_count += i % 2 == 0 ? dictionary.AreSynonyms(second_word, first_word)
+                                  : dictionary.AreSynonyms(first_word, pairs[i - 1].second);
+    }
+    const auto checked = chrono::steady_clock::now();
+
+    const auto add_time = chrono::duration_cast<chrono::milliseconds>(built - start).count();
+    const auto check_time = chrono::duration_cast<chrono::milliseconds>(checked - built).count();
+    cout << name << ": "s << (GetHeapUsage() - heap_before) / (1 << 20) << " MiB, "s
+         << pairs.size() * 1000 / max<long long>(add_time, 1) << " adds/s, "s
+         << pairs.size() * 1000 / max<long long>(check_time, 1) << " checks/s ("s << found_count << " found)"s << endl;
+}
+
+void BenchmarkSynonyms(int pair_count) {
+    mt19937 generator(42);
+    const int word_count = pair_count / 2;
+    vector<pair<string, string>> pairs(pair_count);
+    for (auto& [first_word, second_word]: pairs) {
+        first_word = "word"s + to_string(generator() % word_count);
+        second_word = "word"s + to_string(generator() % word_count);
+    }
+    BenchmarkDictionary<MapSynonyms>("map<string, set<string>>"s, pairs);
+    BenchmarkDictionary<Synonyms>("WordTable + WordPairSet"s, pairs);
+}
+
+// int main() {
+//     BenchmarkSynonyms(5'000'000);
+// }
+
+// Compares answering command_count random commands line by line with
+// the batch mode
+void BenchmarkCommands(int command_count) {
+    mt19937 generator(42);
+    const int word_count = command_count / 4;
+    ostringstream commands;
+    for (int i = 0; i < command_count; ++i) {
+        const int kind = generator() % 100;
+        const string first_word = "word"s + to_string(generator() % word_count);
+        const string second_word = "word"s + to_string(generator() % word_count);
+        if (kind < 5) {
+            commands << "ADD "s << first_word << " "s << second_word << "\n"s;
+        } else if (kind < 50) {
+            commands << "COUNT "s << first_word << "\n"s;
+        } else {
+            commands << "CHECK "s << first_word << " "s << second_word << "\n"s;
         }
     }
-}
\ No newline at end of file
+    const string input = commands.str();
+    ofstream null_output("/dev/null"s);
+
+    {
+        const auto start = chrono::steady_clock::now();
+        istringstream in(input);
+        Synonyms synonyms;
+        RunCommandLoop(in, synonyms, null_output);
+        const auto duration = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start);
+        cout << "getline loop: "s << duration.count() << " ms"s << endl;
+    }
+    {
+        const auto start = chrono::steady_clock::now();
+        Synonyms synonyms;
+        ProcessCommands(input, synonyms, null_output);
+        const auto duration = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start);
+        cout << "batch mode: "s << duration.count() << " ms"s << endl;
+    }
+}
+
+// int main() {
+//     BenchmarkCommands(10'000'000);
+// }
+
+// Latency of single lookups in a dictionary of pair_count random pairs
+// over pair_count / 2 words
+void BenchmarkLookups(int pair_count) {
+    mt19937 generator(42);
+    const int word_count = pair_count / 2;
+    Synonyms synonyms;
+    for (int i = 0; i < pair_count; ++i) {
+        synonyms.Add("word"s + to_string(generator() % word_count), "word"s + to_string(generator() % word_count));
+    }
+    const string word = "word"s + to_string(word_count / 2);
+    const string other_word = "word"s + to_string(word_count / 3);
+    BENCHMARK_ARGS(synonyms.GetSynonymCount, word);
+    BENCHMARK_ARGS(synonyms.AreSynonyms, word, other_word);
+    BENCHMARK_ARGS(synonyms.AreInSameClass, word, other_word);
+}
+
+// int main() {
+//     GetBenchmarkOptions().json_output = &cout;
+//     BenchmarkLookups(1'000'000);
+// }
+
+// Usage: synonims [--batch] < commands. The batch mode reads all of
+// the input first and answers it with ProcessCommands
+int main(int argc, char* argv[]) {
+    TestSynonyms();
+
+    Synonyms synonyms;
+    if (argc > 1 && argv[1] == "--batch"sv) {
+        ProcessCommands(ReadAll(stdin), synonyms, cout);
+    } else {
+        RunCommandLoop(cin, synonyms, cout);
+    }
+}
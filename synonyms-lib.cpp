@@ -0,0 +1,334 @@
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// Words stored back to back in one arena and numbered in the order they
+// first appear. An open-addressing table of ids finds a word's id
+class WordTable {
+public:
+    inline static constexpr int NO_WORD = -1;
+
+    int Intern(string_view word) {
+        size_t slot = FindSlot(word);
+        if (slots_[slot] != NO_WORD) {
+            return slots_[slot];
+        }
+        const int id = GetSize();
+        arena_.append(word);
+        offsets_.push_back(arena_.size());
+        slots_[slot] = id;
+        if (2 * offsets_.size() > slots_.size()) {
+            Rehash();
+        }
+        return id;
+    }
+
+    int Find(string_view word) const {
+        return slots_[FindSlot(word)];
+    }
+
+    string_view GetWord(int id) const {
+        return string_view(arena_).substr(offsets_[id], offsets_[id + 1] - offsets_[id]);
+    }
+
+    int GetSize() const {
+        return offsets_.size() - 1;
+    }
+
+    size_t GetMemoryUsage() const {
+        return arena_.capacity() + offsets_.capacity() * sizeof(uint32_t) + slots_.capacity() * sizeof(int);
+    }
+
+private:
+    string arena_;
+    // Word id -> offset of the word in arena_, and the end of the last one
+    vector<uint32_t> offsets_ = {0};
+    // Kept at most half full; NO_WORD marks an empty slot
+    vector<int> slots_ = vector<int>(16, NO_WORD);
+
+    // The slot holding word or the empty slot where it would go
+    size_t FindSlot(string_view word) const {
+        const size_t mask = slots_.size() - 1;
+        size_t slot = hash<string_view>{}(word) & mask;
+        while (slots_[slot] != NO_WORD && GetWord(slots_[slot]) != word) {
+            slot = (slot + 1) & mask;
+        }
+        return slot;
+    }
+
+    void Rehash() {
+        slots_.assign(slots_.size() * 2, NO_WORD);
+        for (int id = 0; id < GetSize(); ++id) {
+            slots_[FindSlot(GetWord(id))] = id;
+        }
+    }
+};
+
+// Set of unordered pairs of word ids, each packed into one 64-bit key of
+// an open-addressing table
+class WordPairSet {
+public:
+    // Returns false if the pair is already there
+    bool Insert(int first_id, int second_id) {
+        const uint64_t key = MakeKey(first_id, second_id);
+        size_t slot = FindSlot(key);
+        if (slots_[slot] == key) {
+            return false;
+        }
+        slots_[slot] = key;
+        if (2 * ++size_ > slots_.size()) {
+            Rehash();
+        }
+        return true;
+    }
+
+    bool Contains(int first_id, int second_id) const {
+        const uint64_t key = MakeKey(first_id, second_id);
+        return slots_[FindSlot(key)] == key;
+    }
+
+    size_t GetMemoryUsage() const {
+        return slots_.capacity() * sizeof(uint64_t);
+    }
+
+private:
+    // No pair of ids below 2^31 packs into all ones
+    inline static constexpr uint64_t EMPTY = ~uint64_t(0);
+
+    vector<uint64_t> slots_ = vector<uint64_t>(16, EMPTY);
+    size_t size_ = 0;
+
+    static uint64_t MakeKey(int first_id, int second_id) {
+        if (first_id > second_id) {
+            swap(first_id, second_id);
+        }
+        return (static_cast<uint64_t>(first_id) << 32) | static_cast<uint32_t>(second_id);
+    }
+
+    // Consecutive ids would cluster in a linear probe, so the key bits
+    // are mixed first (the splitmix64 finalizer)
+    static uint64_t Mix(uint64_t key) {
+        key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        key = (key ^ (key >> 27)) * 0x94d049bb133111ebULL;
+        return key ^ (key >> 31);
+    }
+
+    size_t FindSlot(uint64_t key) const {
+        const size_t mask = slots_.size() - 1;
+        size_t slot = Mix(key) & mask;
+        while (slots_[slot] != EMPTY && slots_[slot] != key) {
+            slot = (slot + 1) & mask;
+        }
+        return slot;
+    }
+
+    void Rehash() {
+        vector<uint64_t> old_slots(slots_.size() * 2, EMPTY);
+        old_slots.swap(slots_);
+        for (const uint64_t key: old_slots) {
+            if (key != EMPTY) {
+                slots_[FindSlot(key)] = key;
+            }
+        }
+    }
+};
+
+// Keeps direct synonym pairs and, next to them, the classes of words
+// linked by chains of pairs in a disjoint-set forest over word ids
+class Synonyms {
+public:
+    void Add(string_view first_word, string_view second_word) {
+        const int first_id = Intern(first_word);
+        const int second_id = Intern(second_word);
+        if (pairs_.Insert(first_id, second_id)) {
+            ++synonym_counts_[first_id];
+            AddEdge(first_id, second_id);
+            if (second_id != first_id) {
+                ++synonym_counts_[second_id];
+                AddEdge(second_id, first_id);
+            }
+            Unite(first_id, second_id);
+            generation_ = MakeGeneration();
+        }
+    }
+
+    // Adds every whitespace-separated pair of words up to the end of
+    // input. Returns the number of pairs added
+    size_t LoadPairs(istream& input) {
+        size_t pair_count = 0;
+        string first_word, second_word;
+        while (input >> first_word >> second_word) {
+            Add(first_word, second_word);
+            ++pair_count;
+        }
+        return pair_count;
+    }
+
+    size_t GetSynonymCount(string_view word) const {
+        const int word_id = words_.Find(word);
+        return word_id != NO_WORD ? synonym_counts_[word_id] : 0;
+    }
+
+    bool AreSynonyms(string_view first_word, string_view second_word) const {
+        const int first_id = words_.Find(first_word);
+        const int second_id = words_.Find(second_word);
+        return first_id != NO_WORD && second_id != NO_WORD && pairs_.Contains(first_id, second_id);
+    }
+
+    // Calls callback(string_view) for every direct synonym of word, most
+    // recently added first
+    template <typename Callback>
+    void ForEachSynonym(string_view word, Callback callback) const {
+        const int word_id = words_.Find(word);
+        if (word_id == NO_WORD) {
+            return;
+        }
+        for (int edge = first_edges_[word_id]; edge != NO_EDGE; edge = next_edges_[edge]) {
+            callback(words_.GetWord(edge_words_[edge]));
+        }
+    }
+
+    // True if a chain of synonym pairs links the words. A word is in the
+    // same class as itself
+    bool AreInSameClass(string_view first_word, string_view second_word) const {
+        if (first_word == second_word) {
+            return true;
+        }
+        const int first_id = words_.Find(first_word);
+        const int second_id = words_.Find(second_word);
+        return first_id != NO_WORD && second_id != NO_WORD && FindRoot(first_id) == FindRoot(second_id);
+    }
+
+    // Number of words in the class of word, the word itself included
+    size_t GetClassSize(string_view word) const {
+        const int word_id = words_.Find(word);
+        return word_id != NO_WORD ? class_sizes_[FindRoot(word_id)] : 1;
+    }
+
+    // Number of the class of word, or NO_CLASS for a word without
+    // synonyms. Numbers stay the same while the generation does
+    int GetClassId(string_view word) const {
+        const int word_id = words_.Find(word);
+        return word_id != NO_WORD ? FindRoot(word_id) : NO_CLASS;
+    }
+
+    // Calls callback(string_view) for every word in the class of word,
+    // the word itself included
+    template <typename Callback>
+    void ForEachWordInClass(string_view word, Callback callback) const {
+        const int word_id = words_.Find(word);
+        if (word_id == NO_WORD) {
+            callback(word);
+            return;
+        }
+        int class_word_id = word_id;
+        do {
+            callback(words_.GetWord(class_word_id));
+            class_word_id = next_in_class_[class_word_id];
+        } while (class_word_id != word_id);
+    }
+
+    // Changes whenever a new pair is added. Two dictionaries never share
+    // a generation unless one is an unchanged copy of the other, so the
+    // generation may key anything derived from the dictionary
+    uint64_t GetGeneration() const {
+        return generation_;
+    }
+
+    // Bytes of the arrays behind the dictionary
+    size_t GetMemoryUsage() const {
+        return words_.GetMemoryUsage() + pairs_.GetMemoryUsage()
+               + synonym_counts_.capacity() * sizeof(uint32_t) + parents_.capacity() * sizeof(int)
+               + ranks_.capacity() * sizeof(uint8_t) + class_sizes_.capacity() * sizeof(uint32_t)
+               + next_in_class_.capacity() * sizeof(int) + first_edges_.capacity() * sizeof(int)
+               + edge_words_.capacity() * sizeof(int) + next_edges_.capacity() * sizeof(int);
+    }
+
+    inline static constexpr int NO_CLASS = -1;
+
+private:
+    inline static constexpr int NO_WORD = WordTable::NO_WORD;
+    inline static constexpr int NO_EDGE = -1;
+
+    WordTable words_;
+    WordPairSet pairs_;
+    // Word id -> number of direct synonyms
+    vector<uint32_t> synonym_counts_;
+    // Direct synonyms as one singly linked list of edges per word: word
+    // id -> its first edge; edge -> the synonym and the next edge
+    vector<int> first_edges_;
+    vector<int> edge_words_;
+    vector<int> next_edges_;
+
+    // Word id -> parent in its class tree. Roots are their own parents and
+    // keep the rank and size of the class. Lookups shorten the paths
+    // they walk, so even const methods change parents_
+    mutable vector<int> parents_;
+    vector<uint8_t> ranks_;
+    vector<uint32_t> class_sizes_;
+    // Word id -> next word of its class; the words of a class form a cycle
+    vector<int> next_in_class_;
+    uint64_t generation_ = MakeGeneration();
+
+    static uint64_t MakeGeneration() {
+        static atomic<uint64_t> last_generation = 0;
+        return ++last_generation;
+    }
+
+    int Intern(string_view word) {
+        const int word_id = words_.Intern(word);
+        if (word_id == static_cast<int>(parents_.size())) {
+            synonym_counts_.push_back(0);
+            first_edges_.push_back(NO_EDGE);
+            parents_.push_back(word_id);
+            ranks_.push_back(0);
+            class_sizes_.push_back(1);
+            next_in_class_.push_back(word_id);
+        }
+        return word_id;
+    }
+
+    void AddEdge(int word_id, int synonym_id) {
+        edge_words_.push_back(synonym_id);
+        next_edges_.push_back(first_edges_[word_id]);
+        first_edges_[word_id] = static_cast<int>(edge_words_.size()) - 1;
+    }
+
+    int FindRoot(int word_id) const {
+        int root = word_id;
+        while (parents_[root] != root) {
+            root = parents_[root];
+        }
+        while (parents_[word_id] != root) {
+            word_id = exchange(parents_[word_id], root);
+        }
+        return root;
+    }
+
+    // Hangs the lower tree under the higher one, so trees stay
+    // logarithmically shallow even before paths are compressed
+    void Unite(int first_id, int second_id) {
+        int first_root = FindRoot(first_id);
+        int second_root = FindRoot(second_id);
+        if (first_root == second_root) {
+            return;
+        }
+        if (ranks_[first_root] < ranks_[second_root]) {
+            swap(first_root, second_root);
+        }
+        parents_[second_root] = first_root;
+        class_sizes_[first_root] += class_sizes_[second_root];
+        // Swapping successors splices the two cycles into one
+        swap(next_in_class_[first_root], next_in_class_[second_root]);
+        if (ranks_[first_root] == ranks_[second_root]) {
+            ++ranks_[first_root];
+        }
+    }
+};
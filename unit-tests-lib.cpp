@@ -1,6 +1,20 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <exception>
 #include <iostream>
+#include <map>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
 
 using namespace std;
 
@@ -49,4 +63,362 @@ void RunTestImpl(const T& f, const string& f_str, const string& file,
     cerr << f_str << " passed!" << endl;
 }
 
-#define RUN_TEST(func) RunTestImpl((func), #func, __FILE__, __FUNCTION__, __LINE__)
\ No newline at end of file
+#define RUN_TEST(func) RunTestImpl((func), #func, __FILE__, __FUNCTION__, __LINE__)
+
+struct TestCase {
+    string name;
+    void (*function)() = nullptr;
+    string file;
+    unsigned line = 0;
+};
+
+vector<TestCase>& GetTestRegistry() {
+    static vector<TestCase> tests;
+    return tests;
+}
+
+bool RegisterTest(void (*function)(), const string& name, const string& file, unsigned line) {
+    GetTestRegistry().push_back({name, function, file, line});
+    return true;
+}
+
+// Defines a test function and adds it to the registry before main runs:
+// TEST(TestSomething) { ASSERT(...); }
+#define TEST(name) \
+    void name(); \
+    const bool name##_is_registered = RegisterTest(name, #name, __FILE__, __LINE__); \
+    void name()
+
+// jobs tests run at a time, each in a forked process of its own, so an
+// abort fails only its test. Without isolation the tests run one by one
+// in this process, and the first failed assertion ends the run. The
+// slowest_count slowest tests are listed at the end
+struct TestRunOptions {
+    int jobs = static_cast<int>(max(thread::hardware_concurrency(), 1u));
+    bool isolate = true;
+    int slowest_count = 0;
+};
+
+// Usage: [--jobs N] [--no-isolation] [--slowest N]
+TestRunOptions ParseTestRunOptions(int argc, char* argv[]) {
+    TestRunOptions options;
+    for (int i = 1; i < argc; ++i) {
+        const string argument = argv[i];
+        if (argument == "--jobs"s && i + 1 < argc) {
+            options.jobs = max(1, atoi(argv[++i]));
+        } else if (argument == "--slowest"s && i + 1 < argc) {
+            options.slowest_count = max(0, atoi(argv[++i]));
+        } else if (argument == "--no-isolation"s) {
+            options.isolate = false;
+        }
+    }
+    return options;
+}
+
+struct TestOutcome {
+    bool passed = false;
+    string failure;
+    string output;
+    double milliseconds = 0;
+};
+
+// Runs the test in a child whose output goes to a temporary file. The
+// parent must not have started threads of its own yet: only the forking
+// thread exists in the child, and locks the others held stay locked
+pid_t StartIsolatedTest(const TestCase& test, FILE* output) {
+    cout.flush();
+    cerr.flush();
+    const pid_t pid = fork();
+    if (pid != 0) {
+        return pid;
+    }
+    dup2(fileno(output), STDOUT_FILENO);
+    dup2(fileno(output), STDERR_FILENO);
+    int exit_code = 0;
+    try {
+        test.function();
+    } catch (const exception& e) {
+        cerr << "Uncaught exception: "s << e.what() << endl;
+        exit_code = 1;
+    } catch (...) {
+        cerr << "Uncaught exception"s << endl;
+        exit_code = 1;
+    }
+    cout.flush();
+    cerr.flush();
+    _exit(exit_code);
+}
+
+string ReadTestOutput(FILE* output) {
+    string text;
+    rewind(output);
+    char buffer[4096];
+    for (size_t size; (size = fread(buffer, 1, sizeof(buffer), output)) > 0;) {
+        text.append(buffer, size);
+    }
+    fclose(output);
+    return text;
+}
+
+void ReportTest(const TestCase& test, const TestOutcome& outcome) {
+    if (outcome.passed) {
+        cerr << test.name << " passed! ("s << static_cast<long long>(outcome.milliseconds) << " ms)"s << endl;
+    } else {
+        cerr << test.name << " FAILED: "s << outcome.failure
+             << " ("s << static_cast<long long>(outcome.milliseconds) << " ms)"s << endl;
+        cerr << outcome.output;
+    }
+}
+
+// Runs every registered test, reporting each as it finishes, and
+// returns the number of failed tests
+int RunRegisteredTests(const TestRunOptions& options = {}) {
+    const vector<TestCase>& tests = GetTestRegistry();
+    vector<TestOutcome> outcomes(tests.size());
+    const auto run_start = chrono::steady_clock::now();
+    const auto elapsed_ms = [](chrono::steady_clock::time_point start) {
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    };
+
+    if (!options.isolate) {
+        for (size_t i = 0; i < tests.size(); ++i) {
+            const auto start = chrono::steady_clock::now();
+            tests[i].function();
+            outcomes[i].passed = true;
+            outcomes[i].milliseconds = elapsed_ms(start);
+            ReportTest(tests[i], outcomes[i]);
+        }
+    } else {
+        struct RunningTest {
+            size_t index;
+            FILE* output;
+            chrono::steady_clock::time_point start;
+        };
+        map<pid_t, RunningTest> running;
+        size_t next = 0;
+        while (next < tests.size() || !running.empty()) {
+            while (next < tests.size() && static_cast<int>(running.size()) < options.jobs) {
+                FILE* output = tmpfile();
+                const auto start = chrono::steady_clock::now();
+                const pid_t pid = output != nullptr ? StartIsolatedTest(tests[next], output) : -1;
+                if (pid < 0) {
+                    outcomes[next].failure = "cannot start a test process: "s + strerror(errno);
+                    if (output != nullptr) {
+                        fclose(output);
+                    }
+                    ReportTest(tests[next], outcomes[next]);
+                } else {
+                    running[pid] = {next, output, start};
+                }
+                ++next;
+            }
+            if (running.empty()) {
+                continue;
+            }
+            int status = 0;
+            const pid_t pid = wait(&status);
+            if (pid < 0) {
+                break;
+            }
+            const auto it = running.find(pid);
+            if (it == running.end()) {
+                continue;
+            }
+            TestOutcome& outcome = outcomes[it->second.index];
+            outcome.milliseconds = elapsed_ms(it->second.start);
+            outcome.output = ReadTestOutput(it->second.output);
+            if (WIFEXITED(status)) {
+                outcome.passed = WEXITSTATUS(status) == 0;
+                if (!outcome.passed) {
+                    outcome.failure = "exit code "s + to_string(WEXITSTATUS(status));
+                }
+            } else if (WIFSIGNALED(status)) {
+                outcome.failure = "signal "s + to_string(WTERMSIG(status)) + " ("s + strsignal(WTERMSIG(status)) + ")"s;
+            }
+            ReportTest(tests[it->second.index], outcome);
+            running.erase(it);
+        }
+    }
+
+    const int failed = static_cast<int>(count_if(outcomes.begin(), outcomes.end(), [](const TestOutcome& outcome) {
+        return !outcome.passed;
+    }));
+    cerr << tests.size() - failed << " of "s << tests.size() << " tests passed in "s
+         << static_cast<long long>(elapsed_ms(run_start)) << " ms"s << endl;
+
+    if (options.slowest_count > 0) {
+        vector<size_t> order(tests.size());
+        for (size_t i = 0; i < order.size(); ++i) {
+            order[i] = i;
+        }
+        sort(order.begin(), order.end(), [&outcomes](size_t left, size_t right) {
+            return outcomes[left].milliseconds > outcomes[right].milliseconds;
+        });
+        order.resize(min(order.size(), static_cast<size_t>(options.slowest_count)));
+        cerr << "Slowest tests:"s << endl;
+        for (const size_t i : order) {
+            cerr << "    "s << tests[i].name << ": "s << static_cast<long long>(outcomes[i].milliseconds) << " ms"s << endl;
+        }
+    }
+    return failed;
+}
+
+// Makes the compiler assume that value is read, so the computation of
+// a benchmarked result is not thrown away
+template <typename T>
+void DoNotOptimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Makes the compiler assume that all memory is read and written
+void ClobberMemory() {
+    asm volatile("" : : : "memory");
+}
+
+// Each sample repeats the function until it takes at least sample_time;
+// sampling stops after sample_count samples, or after max_total_time
+// once there are MIN_BENCHMARK_SAMPLES. With json_output set, every
+// result is also written there as one JSON object per line
+struct BenchmarkOptions {
+    chrono::nanoseconds warm_up_time = 100ms;
+    chrono::nanoseconds sample_time = 10ms;
+    chrono::nanoseconds max_total_time = 5s;
+    int sample_count = 50;
+    ostream* json_output = nullptr;
+};
+
+const int MIN_BENCHMARK_SAMPLES = 5;
+const int64_t MAX_BENCHMARK_ITERATIONS = int64_t{1} << 40;
+
+BenchmarkOptions& GetBenchmarkOptions() {
+    static BenchmarkOptions options;
+    return options;
+}
+
+// Times of one call in nanoseconds
+struct BenchmarkResult {
+    string name;
+    int64_t iterations = 0;
+    int samples = 0;
+    double min_ns = 0;
+    double median_ns = 0;
+    double p99_ns = 0;
+};
+
+string FormatBenchmarkTime(double ns) {
+    static const pair<double, const char*> units[] = {{1e9, "s"}, {1e6, "ms"}, {1e3, "us"}, {1, "ns"}};
+    for (const auto& [scale, unit] : units) {
+        if (ns >= scale || scale == 1) {
+            ostringstream out;
+            out.precision(3);
+            out << ns / scale << " "s << unit;
+            return out.str();
+        }
+    }
+    return {};
+}
+
+// Full nanoseconds survive, where the default 6 digits would round them
+string FormatJsonNumber(double value) {
+    ostringstream out;
+    out.precision(12);
+    out << value;
+    return out.str();
+}
+
+string EscapeJson(const string& text) {
+    string escaped;
+    for (const char c : text) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            static const char digits[] = "0123456789abcdef";
+            escaped += "\\u00"s;
+            escaped += digits[c >> 4];
+            escaped += digits[c & 0xF];
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+template <typename Function>
+double TimeBenchmarkBatch(Function& f, int64_t iterations) {
+    const auto start = chrono::steady_clock::now();
+    for (int64_t i = 0; i < iterations; ++i) {
+        if constexpr (is_void_v<invoke_result_t<Function&>>) {
+            f();
+        } else {
+            DoNotOptimize(f());
+        }
+        ClobberMemory();
+    }
+    return chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+}
+
+// Warms up, scales the iteration count to the sample time, then reports
+// the minimum, median and 99th percentile of the per-call times
+template <typename Function>
+BenchmarkResult RunBenchmarkImpl(Function f, const string& f_str, const string& file,
+                                 const string& func, unsigned line) {
+    const BenchmarkOptions& options = GetBenchmarkOptions();
+    const double warm_up_ns = chrono::duration<double, nano>(options.warm_up_time).count();
+    const double sample_ns = chrono::duration<double, nano>(options.sample_time).count();
+    const double max_total_ns = chrono::duration<double, nano>(options.max_total_time).count();
+
+    double elapsed = TimeBenchmarkBatch(f, 1);
+    while (elapsed < warm_up_ns) {
+        elapsed += TimeBenchmarkBatch(f, 1);
+    }
+
+    int64_t iterations = 1;
+    for (double batch = TimeBenchmarkBatch(f, 1); batch < sample_ns && iterations < MAX_BENCHMARK_ITERATIONS;
+         batch = TimeBenchmarkBatch(f, iterations)) {
+        const double growth = batch > 0 ? 1.2 * sample_ns / batch : 10.0;
+        iterations = min(MAX_BENCHMARK_ITERATIONS,
+                         static_cast<int64_t>(iterations * clamp(growth, 2.0, 10.0)));
+    }
+
+    vector<double> times;
+    elapsed = 0;
+    while (static_cast<int>(times.size()) < options.sample_count
+           && (static_cast<int>(times.size()) < MIN_BENCHMARK_SAMPLES || elapsed < max_total_ns)) {
+        const double batch = TimeBenchmarkBatch(f, iterations);
+        elapsed += batch;
+        times.push_back(batch / iterations);
+    }
+    sort(times.begin(), times.end());
+
+    BenchmarkResult result;
+    result.name = f_str;
+    result.iterations = iterations;
+    result.samples = static_cast<int>(times.size());
+    result.min_ns = times.front();
+    result.median_ns = times[times.size() / 2];
+    result.p99_ns = times[(times.size() * 99 + 99) / 100 - 1];
+
+    cerr << file << " (line: "s << line << "): "s << func << ": "s
+         << f_str << ": min "s << FormatBenchmarkTime(result.min_ns)
+         << ", median "s << FormatBenchmarkTime(result.median_ns)
+         << ", p99 "s << FormatBenchmarkTime(result.p99_ns)
+         << " ("s << result.samples << " x "s << iterations << " iterations)"s << endl;
+    if (options.json_output != nullptr) {
+        *options.json_output << "{\"name\": \""s << EscapeJson(f_str)
+                             << "\", \"file\": \""s << EscapeJson(file) << "\", \"line\": "s << line
+                             << ", \"func\": \""s << EscapeJson(func)
+                             << "\", \"iterations\": "s << result.iterations << ", \"samples\": "s << result.samples
+                             << ", \"min_ns\": "s << FormatJsonNumber(result.min_ns)
+                             << ", \"median_ns\": "s << FormatJsonNumber(result.median_ns)
+                             << ", \"p99_ns\": "s << FormatJsonNumber(result.p99_ns) << "}"s << endl;
+    }
+    return result;
+}
+
+#define BENCHMARK(func) RunBenchmarkImpl((func), #func, __FILE__, __FUNCTION__, __LINE__)
+
+// Benchmarks func(args...); the arguments are evaluated on every call
+#define BENCHMARK_ARGS(func, ...) \
+    RunBenchmarkImpl([&]() -> decltype(auto) { return func(__VA_ARGS__); }, \
+                     #func "(" #__VA_ARGS__ ")", __FILE__, __FUNCTION__, __LINE__)